@@ -0,0 +1,76 @@
+// Microbenchmark for the nanLanguage interpreter's dispatch loop.
+//
+// Runs a few small scripts with large loop counts and reports the time per
+// executed bytecode instruction (counted before superinstruction fusion, so
+// the numbers stay comparable between builds).
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 bench/nan_dispatch.cpp -o bin/nan_dispatch && ./bin/nan_dispatch
+// Compare against the switch loop or without superinstructions:
+//   g++ -std=c++17 -O2 -DNAN_NO_COMPUTED_GOTO bench/nan_dispatch.cpp -o bin/nan_dispatch_switch
+//   g++ -std=c++17 -O2 -DNAN_NO_SUPERINSTRUCTIONS bench/nan_dispatch.cpp -o bin/nan_dispatch_plain
+
+#include "../nan/interpreter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+struct Scenario {
+    const char* name;
+    std::string body;          // loop body, one command per line
+    int instrsPerIteration;    // bytecode instructions the body runs, + SetLoopVar + LoopNext
+};
+
+static std::string repeat(const std::string& line, int n) {
+    std::string out;
+    for (int i = 0; i < n; i++) out += line;
+    return out;
+}
+
+int main(int argc, char** argv) {
+
+    const int iterations = argc > 1 ? std::atoi(argv[1]) : 2000000;
+    const int reps = 5;
+
+    const Scenario scenarios[] = {
+        // add to a plain variable, last one fuses with LoopNext
+        {"add",        repeat("add x 1\n", 8),                          8 + 2},
+        // compare-and-branch, taken and not taken
+        {"if",         "if i > 5 (\nadd x 1\n)\nif i < 0 (\nadd x 1\n)\n", 3 + 2},
+        // set x = y followed by add x N
+        {"set+add",    repeat("set y = x\nadd y 3\n", 4) + "add x 1\n",  9 + 2},
+        // loop variable feeding arithmetic and a condition
+        {"mixed",      "set y = i\nmult y 3\nif y >= 30 (\nsub x 1\n)\nadd x 2\n", 5 + 2},
+    };
+
+    std::printf("%-10s %12s %12s %10s\n", "scenario", "instrs", "best ms", "ns/instr");
+
+    for (const Scenario& sc : scenarios) {
+
+        std::string script = "set x = 0\nloop i:" + std::to_string(iterations) +
+                             " (\n" + sc.body + ")\n";
+        double instrs = (double)iterations * sc.instrsPerIteration;
+
+        double best = 1e30;
+        for (int r = 0; r < reps; r++) {
+            Interpreter interpreter;
+            auto t0 = std::chrono::steady_clock::now();
+            interpreter.execute(script);
+            auto t1 = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::milli>(t1 - t0).count());
+        }
+
+        std::printf("%-10s %12.0f %12.2f %10.2f\n", sc.name, instrs, best, best * 1e6 / instrs);
+    }
+
+    std::printf("dispatch: %s, superinstructions: %s\n",
+                NAN_COMPUTED_GOTO ? "computed goto" : "switch",
+#ifdef NAN_NO_SUPERINSTRUCTIONS
+                "off"
+#else
+                "on"
+#endif
+    );
+    return 0;
+}
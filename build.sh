@@ -9,5 +9,9 @@ fi
 mkdir -p bin
 
 echo "Compiling server..."
-g++ server.cpp -o bin/server -std=c++17 -O2 -Wall -Wextra -pedantic
+g++ server.cpp -o bin/server -std=c++17 -O2 -Wall -Wextra -pedantic -pthread
 echo "✔ Built: bin/server"
+
+echo "Compiling nan interpreter..."
+g++ user_codes/start_code.cpp -o bin/nan -std=c++17 -O2 -Wall -Wextra -pedantic
+echo "✔ Built: bin/nan"
@@ -0,0 +1,1028 @@
+// nanLanguage interpreter: compiler, bytecode VM and output buffer.
+// Used by the command-line interpreter (user_codes/start_code.cpp), the web
+// server's /run-nan and bench/nan_dispatch.cpp.
+#pragma once
+
+#include <cstdio>       // For writing the output buffer
+#include <charconv>     // For std::to_chars (fast number printing)
+#include <string_view>  // For passing text to the output buffer
+#include <sstream>      // For string streams (parsing lines)
+#include <string>       // For std::string
+#include <map>          // For naming variables while compiling
+#include <vector>       // For the bytecode
+#include <climits>      // For INT_MIN / INT_MAX
+#include <cstdint>      // For fixed-size integers in instructions
+#include <cmath> // for math functions
+#include <cctype>       // For std::isdigit / std::isspace
+#include <cstring>      // For std::memcpy
+#include <functional>   // For sending output somewhere other than a file
+#include <chrono>       // For the wall-clock deadline
+
+// ===============================
+// How a script runs
+// ===============================
+// A nan script is compiled ONCE into a flat list of instructions
+// (bytecode), and then a small virtual machine runs that list.
+//
+// Before, every line was re-parsed with std::istringstream each time it
+// ran, and loop bodies were re-read from strings on every iteration.
+// Now parsing happens a single time, no matter how often a line runs.
+//
+// Example:
+//   loop i:3 (
+//   print i
+//   )
+// becomes
+//   0: LoopBegin   counter 0, count 3, exit -> 4
+//   1: SetLoopVar  i = counter 0
+//   2: PrintVar    i
+//   3: LoopNext    counter 0, count 3, repeat -> 1
+//   4: Halt
+
+// ===============================
+// Bytecode
+// ===============================
+// GCC and Clang can jump to a label stored in a variable (computed goto),
+// which makes the interpreter loop faster. Build with
+// -DNAN_NO_COMPUTED_GOTO to use the portable switch instead.
+#if defined(__GNUC__) && !defined(NAN_NO_COMPUTED_GOTO)
+#define NAN_COMPUTED_GOTO 1
+#else
+#define NAN_COMPUTED_GOTO 0
+#endif
+
+enum class Op : uint8_t {
+    PrintText,     // print strings[a] (+ newline if b)
+    PrintVar,      // print variable in slot a, or its name if undefined
+    SetConst,      // slot a = b
+    SetVar,        // slot a = slot b
+    SetLoopVar,    // slot a = counters[b]
+    Add,           // slot a += b
+    Sub,           // slot a -= b
+    Mult,          // slot a *= b
+    Pow,           // slot a = pow(slot a, b)
+    Div,           // slot a /= b
+    LoopBegin,     // counters[a] = 0; if b <= 0 jump to c
+    LoopNext,      // if ++counters[a] < b jump to c
+    JumpUnless,    // if conditions[a] is false jump to c
+    Fail,          // stop the script with error strings[a]
+    Halt,          // end of script
+
+    // Superinstructions: one instruction doing the work of two.
+    // The second instruction stays in place right after it (and is
+    // skipped), so jumps that land on it still work.
+    AddLoop,       // Add, then the LoopNext that follows
+    SetVarAdd,     // slot a = slot b + d (a SetVar + Add/Sub pair)
+    IfGreater,     // JumpUnless where the condition is
+    IfLess,        //   "variable in slot a <op> number b";
+    IfGreaterEq,   //   d keeps the condition for the slow path
+    IfLessEq,
+    IfEqual,
+    IfNotEqual
+};
+
+struct Instr {
+    Op op;
+    int32_t a = 0;
+    int32_t b = 0;
+    int32_t c = 0;
+    int32_t d = 0;
+};
+
+// One side of a condition: a variable if one with this name exists when
+// the condition runs, otherwise a number.
+// Example: in "if x > 3", x is a variable and 3 a number.
+struct Operand {
+    int slot = 0;           // variable slot with this name
+    bool isNumber = false;  // false: not a number, error if no such variable
+    int number = 0;
+};
+
+enum class Cmp : uint8_t { Greater, Less, GreaterEq, LessEq, Equal, NotEqual, Invalid };
+
+struct Condition {
+    Operand left;
+    Cmp op = Cmp::Invalid;
+    Operand right;
+};
+
+struct Program {
+    std::vector<Instr> code;
+    std::vector<std::string> strings;     // texts to print and error messages
+    std::vector<Condition> conditions;
+    int loopCounters = 0;                 // one hidden counter per loop
+    std::string error;                    // set if the script is too big to run
+};
+
+// ===============================
+// Limits
+// ===============================
+// Inside the web server a script runs in the server's own process, so
+// nothing can kill it from outside. These budgets stop it instead.
+// On the command line they are unlimited.
+// Every byte printed also costs one step, so printing a long text in a
+// loop uses up the budget as fast as the work it really does.
+// (How much of the output is kept is up to whoever receives it.)
+struct Budget {
+    uint64_t steps = UINT64_MAX;    // instructions (+ bytes printed) the script may run
+    size_t memory = SIZE_MAX;       // bytes for bytecode, names and blocks
+    uint64_t output = UINT64_MAX;   // bytes the script may print
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::time_point::max();
+};
+
+// Why a script stopped.
+enum class Stop { Finished, Error, StepLimit, MemoryLimit, OutputLimit, TimeLimit };
+
+// ===============================
+// Variable slots
+// ===============================
+// Every variable name gets a number (its slot) when the script is
+// compiled, so running the script never compares strings.
+// Example: in "set x = 5 / add x 1 / print x" all three lines use slot 0.
+struct Symbols {
+    std::map<std::string, int> slotOf;
+    std::vector<std::string> names;       // names[slot], for messages
+    std::vector<char> assigned;           // some script can set this slot
+
+    int slot(const std::string& name) {
+        auto it = slotOf.find(name);
+        if (it != slotOf.end())
+            return it->second;
+        names.push_back(name);
+        assigned.push_back(0);
+        slotOf.emplace(name, (int)names.size() - 1);
+        return (int)names.size() - 1;
+    }
+
+    int assignedSlot(const std::string& name) {
+        int s = slot(name);
+        assigned[s] = 1;
+        return s;
+    }
+};
+
+// Reads a number the way std::stoi does ("12abc" -> 12).
+// Returns false if there is no number or it doesn't fit in an int.
+inline bool parseNumber(const std::string& text, int& out) {
+    size_t i = 0;
+    while (i < text.size() && std::isspace((unsigned char)text[i])) i++;
+
+    bool negative = false;
+    if (i < text.size() && (text[i] == '+' || text[i] == '-'))
+        negative = text[i++] == '-';
+
+    if (i >= text.size() || !std::isdigit((unsigned char)text[i]))
+        return false;
+
+    long long value = 0;
+    for (; i < text.size() && std::isdigit((unsigned char)text[i]); i++) {
+        value = value * 10 + (text[i] - '0');
+        if (value > (long long)INT_MAX + 1) return false;
+    }
+    if (negative) value = -value;
+    if (value < INT_MIN || value > INT_MAX) return false;
+
+    out = (int)value;
+    return true;
+}
+
+// ===============================
+// Compiler: script text -> bytecode
+// ===============================
+class Compiler {
+public:
+
+    Compiler(Symbols& symbols, size_t memoryLimit)
+        : symbols(symbols), memoryLimit(memoryLimit) {}
+
+    Program compile(const std::string& code) {
+        std::istringstream stream(code);
+        compileBlock(stream);
+        if (!program.error.empty()) {
+            program.code.clear();
+            return std::move(program);
+        }
+        emit(Op::Halt);
+#ifndef NAN_NO_SUPERINSTRUCTIONS
+        fuse();
+#endif
+        return std::move(program);
+    }
+
+private:
+
+    // Each nested block is compiled by a recursive call, so nesting
+    // is limited to keep the stack small.
+    static constexpr int MAX_NESTING = 200;
+
+    Program program;
+    Symbols& symbols;
+    size_t memoryLimit;
+    size_t memoryUsed = 0;
+    int nesting = 0;
+
+    // Counts memory the compiled script will use (roughly).
+    void charge(size_t bytes) {
+        memoryUsed += bytes;
+        if (memoryUsed > memoryLimit && program.error.empty())
+            program.error = "Error: memory limit exceeded";
+    }
+
+    int emit(Op op, int a = 0, int b = 0, int c = 0) {
+        charge(sizeof(Instr));
+        program.code.push_back(Instr{op, a, b, c});
+        return (int)program.code.size() - 1;
+    }
+
+    int here() const { return (int)program.code.size(); }
+
+    int addString(const std::string& s) {
+        charge(sizeof(std::string) + s.size());
+        program.strings.push_back(s);
+        return (int)program.strings.size() - 1;
+    }
+
+    // Slot of a variable name. Counted every time (a map entry plus the
+    // variable's value), even if the name already has a slot.
+    int slot(const std::string& name) {
+        charge(64 + name.size());
+        return symbols.slot(name);
+    }
+
+    int assignedSlot(const std::string& name) {
+        charge(64 + name.size());
+        return symbols.assignedSlot(name);
+    }
+
+    void emitPrint(const std::string& text, bool newline) {
+        emit(Op::PrintText, addString(text), newline);
+    }
+
+    // ============================================
+    // Compile several lines (a whole script or a block)
+    // ============================================
+    void compileBlock(std::istringstream& stream) {
+
+        if (++nesting > MAX_NESTING && program.error.empty())
+            program.error = "Error: blocks nested too deeply";
+
+        std::string line;
+
+        while (program.error.empty() && std::getline(stream, line)) {
+
+            if (line.empty())
+                continue;
+
+            std::istringstream ss(line);
+            std::string command;
+            ss >> command;
+
+            if (command == "loop")
+                compileLoop(ss, stream);
+            else if (command == "if")
+                compileIf(ss, stream);
+            else
+                compileLine(line);
+        }
+
+        nesting--;
+    }
+
+    // =========================
+    // LOOP COMMAND
+    // =========================
+    // Example:
+    // loop i:10 (
+    //     ...
+    // )
+    void compileLoop(std::istringstream& ss, std::istringstream& stream) {
+
+        std::string varAndCount;
+        ss >> varAndCount;
+
+        // Example: i:10
+        size_t colonPos = varAndCount.find(':');
+
+        std::string var = varAndCount.substr(0, colonPos);
+        std::string countText = colonPos == std::string::npos
+                              ? varAndCount
+                              : varAndCount.substr(colonPos + 1);
+
+        int count = 0;
+        if (!parseNumber(countText, count)) {
+            emit(Op::Fail, addString("Error: invalid loop count '" + countText + "'"));
+            return;
+        }
+
+        // Expect "(" at end of line
+        std::string openParen;
+        ss >> openParen;
+
+        if (openParen != "(") {
+            emitPrint("Syntax error: expected (", true);
+            return;
+        }
+
+        // Calculate block separately to support nested loops and ifs
+        std::istringstream block(readBlock(stream));
+
+        // The loop runs on a hidden counter, so changing the loop
+        // variable inside the body doesn't change how often it runs.
+        int counter = program.loopCounters++;
+        int begin = emit(Op::LoopBegin, counter, count);
+        int top = emit(Op::SetLoopVar, assignedSlot(var), counter);
+        compileBlock(block);
+        emit(Op::LoopNext, counter, count, top);
+        program.code[begin].c = here();
+    }
+
+    // =========================
+    // IF COMMAND
+    // =========================
+    // Example:
+    // if x > 3 (
+    //     ...
+    // )
+    void compileIf(std::istringstream& ss, std::istringstream& stream) {
+
+        // Get rest of line after "if"
+        std::string condition;
+        std::getline(ss, condition);
+
+        // Remove trailing "("
+        if (!condition.empty() && condition.back() == '(')
+            condition.pop_back();
+
+        // Trim spaces
+        condition.erase(0, condition.find_first_not_of(" "));
+        condition.erase(condition.find_last_not_of(" ") + 1);
+
+        std::istringstream block(readBlock(stream));
+
+        int jump = emit(Op::JumpUnless, compileCondition(condition));
+        compileBlock(block);
+        program.code[jump].c = here();
+    }
+
+    int compileCondition(const std::string& text) {
+
+        std::istringstream ss(text);
+
+        std::string left, op, right;
+        ss >> left >> op >> right;
+
+        Condition cond;
+        cond.left = compileOperand(left);
+        cond.right = compileOperand(right);
+
+        if (op == ">")       cond.op = Cmp::Greater;
+        else if (op == "<")  cond.op = Cmp::Less;
+        else if (op == ">=") cond.op = Cmp::GreaterEq;
+        else if (op == "<=") cond.op = Cmp::LessEq;
+        else if (op == "==") cond.op = Cmp::Equal;
+        else if (op == "!=") cond.op = Cmp::NotEqual;
+        else                 cond.op = Cmp::Invalid;
+
+        charge(sizeof(Condition));
+        program.conditions.push_back(cond);
+        return (int)program.conditions.size() - 1;
+    }
+
+    Operand compileOperand(const std::string& token) {
+        Operand operand;
+        operand.slot = slot(token);
+        operand.isNumber = parseNumber(token, operand.number);
+        return operand;
+    }
+
+    // ============================================
+    // Compile one single line of code
+    // ============================================
+    void compileLine(const std::string& line) {
+
+        // If line starts with "comment", ignore it
+        if (line.rfind("comment", 0) == 0)
+            return;
+
+        // Create a stream for parsing the line
+        std::istringstream ss(line);
+
+        std::string command;
+
+        // Read the first word (the command)
+        ss >> command;
+
+        // =========================
+        // PRINT / PRINTL COMMANDS
+        // =========================
+        // print "Hello World"   -> text, then a new line
+        // print x               -> value of x (or "x" if there is no x)
+        // printl "Hello"        -> same, without the new line
+        if (command == "print" || command == "printl") {
+
+            bool newline = command == "print";
+
+            // Get everything after the command
+            std::string restOfLine;
+            std::getline(ss, restOfLine);
+
+            // Remove leading space (because getline keeps it)
+            if (!restOfLine.empty() && restOfLine[0] == ' ')
+                restOfLine.erase(0, 1);
+
+            // Case 1: a quoted string
+            if (restOfLine.size() >= 2 &&
+                restOfLine.front() == '"' &&
+                restOfLine.back() == '"') {
+
+                emitPrint(restOfLine.substr(1, restOfLine.size() - 2), newline);
+            }
+            // Case 2: a variable name (or plain text)
+            else {
+                emit(Op::PrintVar, slot(restOfLine), newline);
+            }
+        }
+
+        // =========================
+        // SET COMMAND
+        // =========================
+        // Example:
+        // set x = 5
+        // set x = y
+        else if (command == "set") {
+
+            std::string var;
+            std::string valueToken;
+
+            ss >> var >> valueToken;
+
+            // Case 1: set x = 5
+            if (valueToken == "=") {
+                ss >> valueToken;
+            }
+
+            // Check if it's a number
+            if (std::isdigit((unsigned char)valueToken[0]) ||
+                (valueToken[0] == '-' && valueToken.size() > 1)) {
+
+                int value = 0;
+                if (parseNumber(valueToken, value))
+                    emit(Op::SetConst, assignedSlot(var), value);
+                else
+                    emit(Op::Fail, addString("Error: invalid number '" + valueToken + "'"));
+            }
+            else {
+                // Otherwise treat it as variable
+                emit(Op::SetVar, assignedSlot(var), slot(valueToken));
+            }
+        }
+
+        // =========================
+        // MATH COMMANDS
+        // =========================
+        // Example:
+        // add x 3
+        // sub x 3
+        // mult x 3
+        // pow x 3
+        // div x 2
+        else if (command == "add" || command == "sub" || command == "mult" ||
+                 command == "pow" || command == "div") {
+
+            std::string var;
+            std::string valueToken;
+
+            ss >> var >> valueToken;
+
+            // Read like "ss >> value": no number means 0,
+            // a number that is too big becomes INT_MAX / INT_MIN
+            int value = 0;
+            std::istringstream(valueToken) >> value;
+
+            Op op = command == "add"  ? Op::Add
+                  : command == "sub"  ? Op::Sub
+                  : command == "mult" ? Op::Mult
+                  : command == "pow"  ? Op::Pow
+                  :                     Op::Div;
+            emit(op, slot(var), value);
+        }
+
+        // =========================
+        // UNKNOWN COMMAND
+        // =========================
+        else {
+            emitPrint("Unknown command: " + command, true);
+        }
+    }
+
+    // ============================================
+    // Superinstructions
+    // ============================================
+    // Replaces common pairs of instructions with one that does both:
+    //   add x 1 at the end of a loop body   -> AddLoop
+    //   set x = y, then add/sub x N         -> SetVarAdd
+    //   if x > 3 (                          -> IfGreater (and friends)
+    void fuse() {
+
+        std::vector<Instr>& code = program.code;
+
+        for (size_t i = 0; i + 1 < code.size(); i++) {
+
+            Instr& in = code[i];
+            const Instr& next = code[i + 1];
+
+            if (in.op == Op::Add && next.op == Op::LoopNext) {
+                in.op = Op::AddLoop;
+            }
+            else if (in.op == Op::SetVar && in.a != in.b &&
+                     (next.op == Op::Add || next.op == Op::Sub) && next.a == in.a) {
+                in.op = Op::SetVarAdd;
+                in.d = next.op == Op::Add ? next.b : (int)(uint32_t)(0u - (uint32_t)next.b);
+            }
+            else if (in.op == Op::JumpUnless) {
+                fuseCondition(in);
+            }
+        }
+    }
+
+    // "if x > 3" where x can only be a variable and 3 can only be a
+    // number (no script ever sets a variable called "3").
+    void fuseCondition(Instr& in) {
+
+        const Condition& cond = program.conditions[in.a];
+
+        if (cond.left.isNumber || !cond.right.isNumber ||
+            symbols.assigned[cond.right.slot])
+            return;
+
+        switch (cond.op) {
+        case Cmp::Greater:   in.op = Op::IfGreater;   break;
+        case Cmp::Less:      in.op = Op::IfLess;      break;
+        case Cmp::GreaterEq: in.op = Op::IfGreaterEq; break;
+        case Cmp::LessEq:    in.op = Op::IfLessEq;    break;
+        case Cmp::Equal:     in.op = Op::IfEqual;     break;
+        case Cmp::NotEqual:  in.op = Op::IfNotEqual;  break;
+        case Cmp::Invalid:   return;
+        }
+
+        in.d = in.a;
+        in.a = cond.left.slot;
+        in.b = cond.right.number;
+    }
+
+    // Reads the lines of a block up to its closing ")".
+    std::string readBlock(std::istringstream& stream) {
+        std::string block;
+        std::string line;
+        int depth = 1;
+
+        while (std::getline(stream, line)) {
+
+            for (char c : line) {
+                if (c == '(') depth++;
+                else if (c == ')') depth--;
+            }
+
+            if (depth == 0)
+                break;
+
+            charge(line.size() + 1);
+            if (!program.error.empty())
+                break;
+
+            block += line + "\n";
+        }
+
+        return block;
+    }
+};
+
+// ===============================
+// Output buffer
+// ===============================
+// Printing with std::cout << std::endl flushes after every line, so
+// "loop i:100000 ( print i )" used to make 100000 separate writes.
+// Output is now collected in a buffer and written out in big chunks:
+//   - when the buffer is full
+//   - when the script ends
+//   - before an error message goes to stderr (so the order stays right)
+// Each chunk goes to a Writer: a file, or anything else that takes bytes
+// (the web server keeps them in the same capped buffer as /run).
+using Writer = std::function<void(const char* data, size_t size)>;
+
+class OutputSink {
+public:
+
+    explicit OutputSink(std::FILE* file)
+        : writer([file](const char* data, size_t size) {
+              std::fwrite(data, 1, size, file);
+              std::fflush(file);
+          }) {}
+
+    explicit OutputSink(Writer writer) : writer(std::move(writer)) {}
+
+    ~OutputSink() { flush(); }
+
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    void write(std::string_view text) {
+        total += text.size();
+        if (text.size() > sizeof(buffer) - used) {
+            flush();
+            if (text.size() > sizeof(buffer)) {
+                writer(text.data(), text.size());
+                return;
+            }
+        }
+        std::memcpy(buffer + used, text.data(), text.size());
+        used += text.size();
+    }
+
+    void write(char c) {
+        total++;
+        if (used == sizeof(buffer))
+            flush();
+        buffer[used++] = c;
+    }
+
+    // Numbers are formatted with std::to_chars: no locale, no iostream.
+    void write(int value) {
+        if (sizeof(buffer) - used < 16)
+            flush();
+        char* end = std::to_chars(buffer + used, buffer + sizeof(buffer), value).ptr;
+        total += (end - buffer) - used;
+        used = end - buffer;
+    }
+
+    void flush() {
+        if (used == 0)
+            return;
+        writer(buffer, used);
+        used = 0;
+    }
+
+    // Bytes written so far, buffered or not.
+    uint64_t written() const { return total; }
+
+private:
+
+    Writer writer;
+    uint64_t total = 0;
+    char buffer[1 << 16];
+    size_t used = 0;
+};
+
+// ===============================
+// Simple Interpreter Class
+// ===============================
+class Interpreter {
+private:
+
+    // Variables, stored by slot
+    // Example:
+    // set x = 5
+    // If x has slot 0, this will store: values[0] = 5, defined[0] = true
+    Symbols symbols;
+    std::vector<int> values;
+    std::vector<char> defined;
+
+    // Everything the script prints goes through here
+    OutputSink out{stdout};
+    OutputSink err{stderr};
+
+    Budget budget;
+    uint64_t stepsLeft = budget.steps;
+    uint64_t printedCharged = 0;      // output bytes already paid for in steps
+    uint64_t stepsAtClockCheck = budget.steps;
+    Stop stop = Stop::Finished;
+
+public:
+
+    // Prints to stdout/stderr, no limits.
+    Interpreter() = default;
+
+    // For running inside another program (the web server): output and
+    // errors go to the two writers and the budget applies.
+    Interpreter(const Budget& budget, Writer output, Writer errors)
+        : out(std::move(output)), err(std::move(errors)),
+          budget(budget), stepsLeft(budget.steps), stepsAtClockCheck(budget.steps) {}
+
+    // ============================================
+    // Execute full script (multiple lines of code)
+    // ============================================
+    // Returns false if the script stopped with an error.
+    bool execute(const std::string& code) {
+        Program program = Compiler(symbols, budget.memory).compile(code);
+        if (!program.error.empty()) {
+            stop = Stop::MemoryLimit;
+            fatal(program.error);
+            return false;
+        }
+        values.resize(symbols.names.size(), 0);
+        defined.resize(symbols.names.size(), 0);
+        bool ok = run(program);
+        out.flush();
+        return ok;
+    }
+
+    Stop stopReason() const { return stop; }
+
+    // Instructions run so far, counted at the end of each loop iteration.
+    uint64_t stepsUsed() const { return budget.steps - stepsLeft; }
+
+private:
+
+    // Math on ints that wraps around instead of overflowing
+    static int wrap(long long value) {
+        return (int)(uint32_t)(uint64_t)value;
+    }
+
+    static int toInt(double value) {
+        if (std::isnan(value)) return 0;
+        if (value >= 2147483647.0) return INT_MAX;
+        if (value <= -2147483648.0) return INT_MIN;
+        return (int)value;
+    }
+
+    void notFound(int slot) {
+        out.write("Error: variable '");
+        out.write(symbols.names[slot]);
+        out.write("' not found\n");
+    }
+
+    // Stops the script: the message goes to stderr after any output.
+    void fatal(const std::string& message) {
+        if (stop == Stop::Finished)
+            stop = Stop::Error;
+        out.flush();
+        err.write(message);
+        err.write('\n');
+        err.flush();
+    }
+
+    // Pays for one more round of a loop body: `steps` instructions plus
+    // every byte printed since the last payment. Code outside loops runs
+    // at most once, so only loops are counted. This is also where the
+    // output budget and, every CLOCK_CHECK_STEPS, the deadline are checked.
+    static constexpr uint64_t CLOCK_CHECK_STEPS = 1 << 20;
+
+    bool spend(size_t steps) {
+        uint64_t printed = out.written();
+        uint64_t cost = steps + (printed - printedCharged);
+        printedCharged = printed;
+
+        if (cost > stepsLeft) {
+            stepsLeft = 0;
+            stop = Stop::StepLimit;
+            fatal("Error: instruction budget exhausted");
+            return false;
+        }
+        stepsLeft -= cost;
+
+        if (printed > budget.output) {
+            stop = Stop::OutputLimit;
+            fatal("Error: output limit exceeded");
+            return false;
+        }
+
+        if (stepsAtClockCheck - stepsLeft >= CLOCK_CHECK_STEPS) {
+            stepsAtClockCheck = stepsLeft;
+            if (std::chrono::steady_clock::now() > budget.deadline) {
+                stop = Stop::TimeLimit;
+                fatal("Error: time limit exceeded");
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Value of one side of a condition.
+    bool operandValue(const Operand& operand, int& out) {
+        if (defined[operand.slot]) {
+            out = values[operand.slot];
+            return true;
+        }
+        out = operand.number;
+        return operand.isNumber;
+    }
+
+    // Returns 1 if the condition is true, 0 if false, -1 on error.
+    int evaluateCondition(const Condition& cond) {
+
+        int left = 0, right = 0;
+        if (!operandValue(cond.left, left)) {
+            fatal("Error: variable '" + symbols.names[cond.left.slot] + "' not found");
+            return -1;
+        }
+        if (!operandValue(cond.right, right)) {
+            fatal("Error: variable '" + symbols.names[cond.right.slot] + "' not found");
+            return -1;
+        }
+
+        switch (cond.op) {
+        case Cmp::Greater:   return left > right;
+        case Cmp::Less:      return left < right;
+        case Cmp::GreaterEq: return left >= right;
+        case Cmp::LessEq:    return left <= right;
+        case Cmp::Equal:     return left == right;
+        case Cmp::NotEqual:  return left != right;
+        case Cmp::Invalid:   break;
+        }
+
+        out.write("Invalid operator in condition\n");
+        return 0;
+    }
+
+    // ============================================
+    // The virtual machine: run the bytecode
+    // ============================================
+    // With GCC/Clang each instruction jumps straight to the code of the
+    // next one ("computed goto"): the address of every instruction's
+    // handler is looked up once, before the script starts. Other
+    // compilers use a plain switch in a loop.
+#if NAN_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"   // computed goto is a GNU extension
+#endif
+    bool run(const Program& p) {
+
+        const Instr* code = p.code.data();
+        std::vector<int> counters(p.loopCounters, 0);
+        size_t pc = 0;
+        const Instr* in = nullptr;
+
+#if NAN_COMPUTED_GOTO
+        // Must follow the order of enum class Op
+        static void* const labels[] = {
+            &&op_PrintText, &&op_PrintVar, &&op_SetConst, &&op_SetVar,
+            &&op_SetLoopVar, &&op_Add, &&op_Sub, &&op_Mult, &&op_Pow,
+            &&op_Div, &&op_LoopBegin, &&op_LoopNext, &&op_JumpUnless,
+            &&op_Fail, &&op_Halt, &&op_AddLoop, &&op_SetVarAdd,
+            &&op_IfGreater, &&op_IfLess, &&op_IfGreaterEq, &&op_IfLessEq,
+            &&op_IfEqual, &&op_IfNotEqual
+        };
+        static_assert(sizeof(labels) / sizeof(labels[0]) == (size_t)Op::IfNotEqual + 1,
+                      "labels must list every Op");
+
+        std::vector<void*> threaded(p.code.size());
+        for (size_t i = 0; i < p.code.size(); i++)
+            threaded[i] = labels[(int)p.code[i].op];
+
+#define TARGET(name) op_##name:
+#define NEXT() do { in = &code[pc]; goto *threaded[pc++]; } while (0)
+
+        NEXT();
+#else
+#define TARGET(name) case Op::name:
+#define NEXT() break
+
+        for (;;) {
+        in = &code[pc++];
+        switch (in->op) {
+#endif
+
+        TARGET(PrintText)
+            out.write(p.strings[in->a]);
+            if (in->b) out.write('\n');
+            NEXT();
+
+        TARGET(PrintVar)
+            if (defined[in->a]) {
+                out.write(values[in->a]);
+                out.write('\n');
+            }
+            else {
+                out.write(symbols.names[in->a]);
+                if (in->b) out.write('\n');
+            }
+            NEXT();
+
+        TARGET(SetConst)
+            values[in->a] = in->b;
+            defined[in->a] = 1;
+            NEXT();
+
+        TARGET(SetVar)
+            if (defined[in->b]) {
+                values[in->a] = values[in->b];
+                defined[in->a] = 1;
+            }
+            else
+                notFound(in->b);
+            NEXT();
+
+        TARGET(SetLoopVar)
+            values[in->a] = counters[in->b];
+            defined[in->a] = 1;
+            NEXT();
+
+        TARGET(Add)
+            if (defined[in->a]) values[in->a] = wrap((long long)values[in->a] + in->b);
+            else notFound(in->a);
+            NEXT();
+
+        TARGET(Sub)
+            if (defined[in->a]) values[in->a] = wrap((long long)values[in->a] - in->b);
+            else notFound(in->a);
+            NEXT();
+
+        TARGET(Mult)
+            if (defined[in->a]) values[in->a] = wrap((long long)values[in->a] * in->b);
+            else notFound(in->a);
+            NEXT();
+
+        TARGET(Pow)
+            if (defined[in->a]) values[in->a] = toInt(std::pow(values[in->a], in->b));
+            else notFound(in->a);
+            NEXT();
+
+        TARGET(Div)
+            if (!defined[in->a]) notFound(in->a);
+            else if (in->b == 0) out.write("Error: division by zero\n");
+            else values[in->a] = wrap((long long)values[in->a] / in->b);
+            NEXT();
+
+        TARGET(LoopBegin)
+            counters[in->a] = 0;
+            if (in->b <= 0) pc = in->c;
+            NEXT();
+
+        TARGET(LoopNext)
+            if (++counters[in->a] < in->b) {
+                if (!spend(pc - in->c)) return false;
+                pc = in->c;
+            }
+            NEXT();
+
+        TARGET(JumpUnless) {
+            int result = evaluateCondition(p.conditions[in->a]);
+            if (result < 0) return false;
+            if (!result) pc = in->c;
+            NEXT();
+        }
+
+        TARGET(Fail)
+            fatal(p.strings[in->a]);
+            return false;
+
+        TARGET(Halt)
+            return true;
+
+        TARGET(AddLoop) {
+            if (defined[in->a]) values[in->a] = wrap((long long)values[in->a] + in->b);
+            else notFound(in->a);
+            const Instr& loop = code[pc];
+            if (++counters[loop.a] < loop.b) {
+                if (!spend(pc + 1 - loop.c)) return false;
+                pc = loop.c;
+            }
+            else
+                pc++;
+            NEXT();
+        }
+
+        TARGET(SetVarAdd)
+            if (defined[in->b]) {
+                values[in->a] = wrap((long long)values[in->b] + in->d);
+                defined[in->a] = 1;
+                pc++;
+            }
+            else
+                notFound(in->b);    // the add/sub that follows runs on its own
+            NEXT();
+
+#define COMPARE_AND_BRANCH(name, OP)                                        \
+        TARGET(name)                                                        \
+            if (defined[in->a]) {                                           \
+                if (!(values[in->a] OP in->b)) pc = in->c;                  \
+            }                                                               \
+            else {                                                          \
+                int result = evaluateCondition(p.conditions[in->d]);        \
+                if (result < 0) return false;                               \
+                if (!result) pc = in->c;                                    \
+            }                                                               \
+            NEXT();
+
+        COMPARE_AND_BRANCH(IfGreater, >)
+        COMPARE_AND_BRANCH(IfLess, <)
+        COMPARE_AND_BRANCH(IfGreaterEq, >=)
+        COMPARE_AND_BRANCH(IfLessEq, <=)
+        COMPARE_AND_BRANCH(IfEqual, ==)
+        COMPARE_AND_BRANCH(IfNotEqual, !=)
+
+#undef COMPARE_AND_BRANCH
+#undef TARGET
+#undef NEXT
+
+#if !NAN_COMPUTED_GOTO
+        }
+        }
+#endif
+        return true;
+    }
+#if NAN_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
+};
@@ -1,29 +1,156 @@
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/random.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <cerrno>
 #include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <condition_variable>
+#include <cstdio>
 #include <cstring>
+#include <deque>
 #include <filesystem>
 #include <fstream>
+#include <future>
+#include <functional>
 #include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <queue>
 #include <sstream>
 #include <string>
 #include <thread>
 #include <unordered_map>
 #include <vector>
+#include <algorithm>
 #include <regex>
 #include <nlohmann/json.hpp>
 using json = nlohmann::json;
 
+// The nanLanguage interpreter, built into the server for /run-nan.
+#include "nan/interpreter.h"
+
 
 #define PORT 8080
 
+// ------------------------- Configuration -------------------------
+
+// Tunables read once from the environment at startup (WEBCPP_*).
+struct ServerConfig {
+    size_t workers = 1;       // WEBCPP_WORKERS: compile/run worker threads
+    size_t queue_limit = 4;   // WEBCPP_QUEUE_LIMIT: jobs allowed to wait for a worker
+    size_t output_cap = 1024 * 1024;  // WEBCPP_OUTPUT_CAP_KB: bytes kept per stream
+    std::chrono::seconds handle_ttl{600};   // WEBCPP_HANDLE_TTL_S: idle lifetime of a /compile handle
+    size_t max_handles = 1024;              // WEBCPP_MAX_HANDLES
+    size_t batch_max_cases = 256;           // WEBCPP_BATCH_MAX_CASES: cases per /run-batch
+    bool in_memory = false;   // WEBCPP_IN_MEMORY=1: /run defaults to the memfd path
+    uint64_t result_cache_bytes = 64ULL * 1024 * 1024;   // WEBCPP_RESULT_CACHE_MB (0 disables)
+    std::chrono::seconds result_ttl{300};                // WEBCPP_RESULT_TTL_S
+    size_t sandbox_min = 2;   // WEBCPP_SANDBOX_MIN: pre-warmed sandboxes kept when idle
+    size_t sandbox_max = 2;   // WEBCPP_SANDBOX_MAX: upper bound under load (0 disables the pool)
+    bool cgroups = true;                            // WEBCPP_CGROUPS=0 forces plain rlimits
+    uint64_t run_memory_max = 256ULL * 1024 * 1024; // WEBCPP_RUN_MEMORY_MB (memory.max)
+    uint32_t run_cpu_percent = 100;                 // WEBCPP_RUN_CPU_PERCENT (cpu.max)
+    uint32_t run_pids_max = 64;                     // WEBCPP_RUN_PIDS_MAX (pids.max)
+    std::string cache_dir = "user_codes/.cache";         // WEBCPP_CACHE_DIR
+    uint64_t cache_max_bytes = 512ULL * 1024 * 1024;     // WEBCPP_CACHE_MAX_MB
+    std::string object_cache_dir = "user_codes/.objcache";     // WEBCPP_OBJECT_CACHE_DIR
+    uint64_t object_cache_max_bytes = 256ULL * 1024 * 1024;    // WEBCPP_OBJECT_CACHE_MAX_MB
+    size_t project_max_files = 64;                             // WEBCPP_PROJECT_MAX_FILES
+    uint64_t nan_max_steps = 200000000;        // WEBCPP_NAN_MAX_STEPS: instructions per /run-nan
+    size_t nan_memory_max = 64 * 1024 * 1024;  // WEBCPP_NAN_MEMORY_MB
+    std::string pch_dir = "user_codes/.pch";             // WEBCPP_PCH_DIR
+    // WEBCPP_PCH: prologues separated by ';', headers within one by ','.
+    // Set it to an empty string to disable precompiled headers.
+    std::vector<std::vector<std::string>> pch_prologues = {
+        {"bits/stdc++.h"},
+        {"iostream"},
+        {"iostream", "vector"},
+        {"iostream", "string"},
+        {"algorithm", "iostream", "string", "vector"},
+    };
+};
+
+static ServerConfig g_config;
+
+static std::vector<std::string> split(const std::string& s, char sep) {
+    std::vector<std::string> parts;
+    std::string part;
+    std::istringstream in(s);
+    while (std::getline(in, part, sep)) parts.push_back(part);
+    return parts;
+}
+
+static size_t env_size(const char* name, size_t fallback) {
+    const char* v = std::getenv(name);
+    if (!v || !*v) return fallback;
+    char* end = nullptr;
+    unsigned long long n = std::strtoull(v, &end, 10);
+    if (*end != '\0') return fallback;
+    return (size_t)n;
+}
+
+static ServerConfig load_config() {
+    ServerConfig c;
+    size_t cores = std::thread::hardware_concurrency();
+    c.workers = std::max<size_t>(1, env_size("WEBCPP_WORKERS", cores ? cores : 1));
+    c.queue_limit = env_size("WEBCPP_QUEUE_LIMIT", 4 * c.workers);
+    c.output_cap = std::max<size_t>(2, env_size("WEBCPP_OUTPUT_CAP_KB", 1024) * 1024);
+    c.handle_ttl = std::chrono::seconds(std::max<size_t>(1, env_size("WEBCPP_HANDLE_TTL_S", 600)));
+    c.max_handles = env_size("WEBCPP_MAX_HANDLES", 1024);
+    c.batch_max_cases = std::max<size_t>(1, env_size("WEBCPP_BATCH_MAX_CASES", 256));
+    c.in_memory = env_size("WEBCPP_IN_MEMORY", 0) != 0;
+    c.result_cache_bytes = (uint64_t)env_size("WEBCPP_RESULT_CACHE_MB", 64) * 1024 * 1024;
+    c.result_ttl = std::chrono::seconds(std::max<size_t>(1, env_size("WEBCPP_RESULT_TTL_S", 300)));
+    c.sandbox_min = env_size("WEBCPP_SANDBOX_MIN", 2);
+    c.sandbox_max = env_size("WEBCPP_SANDBOX_MAX", 2 * c.workers);
+    c.cgroups = env_size("WEBCPP_CGROUPS", 1) != 0;
+    c.run_memory_max = (uint64_t)env_size("WEBCPP_RUN_MEMORY_MB", 256) * 1024 * 1024;
+    c.run_cpu_percent = (uint32_t)std::max<size_t>(1, env_size("WEBCPP_RUN_CPU_PERCENT", 100));
+    c.run_pids_max = (uint32_t)std::max<size_t>(1, env_size("WEBCPP_RUN_PIDS_MAX", 64));
+    if (const char* dir = std::getenv("WEBCPP_CACHE_DIR"); dir && *dir) c.cache_dir = dir;
+    c.cache_max_bytes = (uint64_t)env_size("WEBCPP_CACHE_MAX_MB", 512) * 1024 * 1024;
+    if (const char* dir = std::getenv("WEBCPP_OBJECT_CACHE_DIR"); dir && *dir) c.object_cache_dir = dir;
+    c.object_cache_max_bytes = (uint64_t)env_size("WEBCPP_OBJECT_CACHE_MAX_MB", 256) * 1024 * 1024;
+    c.project_max_files = std::max<size_t>(1, env_size("WEBCPP_PROJECT_MAX_FILES", 64));
+    c.nan_max_steps = std::max<size_t>(1, env_size("WEBCPP_NAN_MAX_STEPS", 200000000));
+    c.nan_memory_max = std::max<size_t>(1, env_size("WEBCPP_NAN_MEMORY_MB", 64)) * 1024 * 1024;
+    if (const char* dir = std::getenv("WEBCPP_PCH_DIR"); dir && *dir) c.pch_dir = dir;
+    if (const char* spec = std::getenv("WEBCPP_PCH")) {
+        c.pch_prologues.clear();
+        for (const auto& prologue : split(spec, ';')) {
+            std::vector<std::string> headers;
+            for (auto h : split(prologue, ',')) {
+                h.erase(std::remove_if(h.begin(), h.end(), [](unsigned char ch) { return std::isspace(ch); }), h.end());
+                if (!h.empty()) headers.push_back(h);
+            }
+            if (!headers.empty()) c.pch_prologues.push_back(headers);
+        }
+    }
+    return c;
+}
+
 // URL decode (basic)
 static std::string url_decode(const std::string& s) {
     std::string out;
@@ -65,10 +192,10 @@ static std::unordered_map<std::string, std::string> parse_query(const std::strin
     return m;
 }
 
-// Only allow safe filenames like "star_code.cpp" or "test-1.cpp"
-static std::optional<std::string> sanitize_cpp_filename(const std::string& name) {
+// Only allow safe filenames like "star_code.cpp", "test-1.cpp" or "util.h"
+static std::optional<std::string> sanitize_source_filename(const std::string& name) {
     if (name.size() > 80) return std::nullopt;
-    static const std::regex ok(R"(^[A-Za-z0-9_.-]+\.cpp$)");
+    static const std::regex ok(R"(^[A-Za-z0-9_.-]+\.(cpp|h|hpp)$)");
     if (!std::regex_match(name, ok)) return std::nullopt;
     if (name.find("..") != std::string::npos) return std::nullopt;
     return name;
@@ -133,27 +260,19 @@ static std::optional<HttpRequest> parse_http_request(const std::string& raw) {
 static std::string http_response(int status_code,
                                  const std::string& status_text,
                                  const std::string& content_type,
-                                 const std::string& body) {
+                                 const std::string& body,
+                                 const std::string& extra_headers = "") {
     std::ostringstream out;
     out << "HTTP/1.1 " << status_code << " " << status_text << "\r\n";
     out << "Content-Type: " << content_type << "\r\n";
     out << "Content-Length: " << body.size() << "\r\n";
     out << "Connection: close\r\n";
+    out << extra_headers;
     out << "\r\n";
     out << body;
     return out.str();
 }
 
-static bool send_all(int fd, const std::string& data) {
-    size_t sent = 0;
-    while (sent < data.size()) {
-        ssize_t n = send(fd, data.data() + sent, data.size() - sent, 0);
-        if (n <= 0) return false;
-        sent += (size_t)n;
-    }
-    return true;
-}
-
 static std::string read_file(const std::string& path) {
     std::ifstream f(path, std::ios::binary);
     if (!f) return "";
@@ -162,59 +281,35 @@ static std::string read_file(const std::string& path) {
     return ss.str();
 }
 
-// Reads until headers are complete, then reads Content-Length bytes (if present).
-static std::string read_http_from_socket(int fd) {
-    constexpr size_t MAX_REQ = 512 * 1024; // 512 KB limit for safety
-    std::string data;
-    char buf[4096];
-
-    // Read until we have headers
-    while (data.find("\r\n\r\n") == std::string::npos) {
-        ssize_t n = recv(fd, buf, sizeof(buf), 0);
-        if (n <= 0) break;
-        data.append(buf, buf + n);
-        if (data.size() > MAX_REQ) break;
-    }
-
-    auto header_end = data.find("\r\n\r\n");
-    if (header_end == std::string::npos) return data;
-
-    // Parse Content-Length (if any)
-    auto maybe_req = parse_http_request(data);
-    if (!maybe_req) return data;
-
-    auto it = maybe_req->headers.find("content-length");
-    if (it == maybe_req->headers.end()) return data;
-
-    long long content_length = 0;
-    try {
-        content_length = std::stoll(it->second);
-    } catch (...) {
-        return data;
-    }
-    if (content_length < 0 || content_length > (long long)MAX_REQ) return data;
-
-    std::string body = data.substr(header_end + 4);
-    while ((long long)body.size() < content_length) {
-        ssize_t n = recv(fd, buf, sizeof(buf), 0);
-        if (n <= 0) break;
-        body.append(buf, buf + n);
-        if (body.size() > MAX_REQ) break;
-    }
-
-    return data.substr(0, header_end + 4) + body;
-}
-
 // ------------------------- Sandboxed-ish runner -------------------------
 
-static void apply_run_limits() {
-    // CPU time: 2 seconds
-    struct rlimit rl_cpu {2, 2};
+constexpr rlim_t RUN_CPU_LIMIT_SECONDS = 2;
+// Wall-clock deadline for user programs. The grace over the CPU limit lets
+// a CPU-bound program hit RLIMIT_CPU (and be reported as such) before the
+// wall clock fires; the deadline is what stops sleepers and blocked reads.
+constexpr int RUN_TIMEOUT_MS = RUN_CPU_LIMIT_SECONDS * 1000 + 500;
+// Whole job, from the moment it is accepted: queued + compile + run.
+// The client gets a timeout after this, so a nan script stops here too.
+constexpr int JOB_TIMEOUT_MS = 120000;
+// A nan script may print this many times WEBCPP_OUTPUT_CAP_KB before it is
+// stopped; only the head and tail of it are kept either way.
+constexpr size_t NAN_OUTPUT_CAP_MULTIPLE = 8;
+
+// `memory_in_cgroup`: the job's cgroup enforces memory.max, which counts
+// what is actually used. RLIMIT_AS is only the fallback; it counts reserved
+// address space and kills programs that merely map a lot.
+static void apply_run_limits(bool memory_in_cgroup) {
+    // CPU time: 2 seconds. The hard limit sits one second higher so the
+    // kernel sends SIGXCPU at the soft limit (with soft == hard it goes
+    // straight to SIGKILL, which looks like any other kill).
+    struct rlimit rl_cpu {RUN_CPU_LIMIT_SECONDS, RUN_CPU_LIMIT_SECONDS + 1};
     setrlimit(RLIMIT_CPU, &rl_cpu);
 
     // Address space: 256 MB (rough memory cap)
-    struct rlimit rl_as {256ULL * 1024ULL * 1024ULL, 256ULL * 1024ULL * 1024ULL};
-    setrlimit(RLIMIT_AS, &rl_as);
+    if (!memory_in_cgroup) {
+        struct rlimit rl_as {256ULL * 1024ULL * 1024ULL, 256ULL * 1024ULL * 1024ULL};
+        setrlimit(RLIMIT_AS, &rl_as);
+    }
 
     // Output file size: 1 MB
     struct rlimit rl_fsize {1ULL * 1024ULL * 1024ULL, 1ULL * 1024ULL * 1024ULL};
@@ -225,414 +320,3491 @@ static void apply_run_limits() {
     setrlimit(RLIMIT_NOFILE, &rl_nofile);
 }
 
-struct ProcResult {
-    int exit_code = -1;
-    bool timed_out = false;
-    std::string output; // combined stdout+stderr
+// ------------------------- Process spawning -------------------------
+
+struct SpawnRequest {
+    std::vector<std::string> args;
+    std::string cwd;
+    bool limit_resources = false;
+    int stdin_fd = -1;
+    int stdout_fd = -1;
+    int stderr_fd = -1;
+    int cgroup_procs_fd = -1;   // job cgroup to join before exec, if any
+    // Pre-warmed sandbox: once set up, wait for the real argv on this fd
+    // (NUL-separated, ended by EOF) instead of exec'ing `args`.
+    int control_fd = -1;
+    std::vector<std::string> env;  // extra "NAME=value" entries for the child
+    int inherit_fd = -1;        // handed to the child as fd 3 (e.g. the compiler's output)
+    int exec_fd = -1;           // run this file (fexecve) instead of looking up args[0]
 };
-static ProcResult run_process_capture(
-    const std::vector<std::string>& args,
-    const std::string& input,
-    int timeout_ms,
-    bool limit_resources)
-{
-    ProcResult res;
-
-    int stdout_pipe[2];
-    int stdin_pipe[2];
-
-    if (pipe(stdout_pipe) != 0 || pipe(stdin_pipe) != 0) {
-        res.output = "Internal error: pipe() failed.\n";
-        return res;
-    }
 
-    pid_t pid = fork();
-    if (pid == -1) {
-        close(stdout_pipe[0]); close(stdout_pipe[1]);
-        close(stdin_pipe[0]);  close(stdin_pipe[1]);
-        res.output = "Internal error: fork() failed.\n";
-        return res;
+// Reads a sandbox's argv from `fd` into `buf`, splitting it in place.
+// No allocation: this runs in a forked child of a threaded process when
+// the zygote is unavailable. Returns false on EOF without a command (the
+// pool is retiring the sandbox) or on a malformed one.
+static bool read_control_args(int fd, char* buf, size_t cap, char** argv, size_t max_args) {
+    size_t len = 0;
+    for (;;) {
+        if (len == cap) return false;
+        ssize_t n = read(fd, buf + len, cap - len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        len += (size_t)n;
     }
+    if (len == 0 || buf[len - 1] != '\0') return false;
 
-    if (pid == 0) {
-        // ---------------- CHILD ----------------
-        setpgid(0, 0);
+    size_t argc = 0;
+    for (size_t i = 0; i < len && argc + 1 < max_args; i += strlen(buf + i) + 1)
+        argv[argc++] = buf + i;
+    argv[argc] = nullptr;
+    return argc > 0;
+}
 
-        if (limit_resources)
-            apply_run_limits();
+// Child side of every spawn: new process group, workspace cwd, limits,
+// stdio redirection, exec. Only called right after fork/clone.
+[[noreturn]] static void exec_child(const SpawnRequest& req) {
+    setpgid(0, 0);
 
-        // Redirect stdout and stderr
-        dup2(stdout_pipe[1], STDOUT_FILENO);
-        dup2(stdout_pipe[1], STDERR_FILENO);
+    // The server ignores SIGPIPE; ignored dispositions survive exec.
+    signal(SIGPIPE, SIG_DFL);
 
-        // Redirect stdin
-        dup2(stdin_pipe[0], STDIN_FILENO);
+    if (!req.cwd.empty() && chdir(req.cwd.c_str()) != 0)
+        _exit(127);
 
-        close(stdout_pipe[0]);
-        close(stdout_pipe[1]);
-        close(stdin_pipe[0]);
-        close(stdin_pipe[1]);
+    // Join the job cgroup while still running our own code, so everything
+    // the program does is accounted and limited from its first instruction.
+    // Running without it would mean running without a memory limit.
+    if (req.cgroup_procs_fd >= 0 && write(req.cgroup_procs_fd, "0", 1) != 1)
+        _exit(127);
 
+    if (req.limit_resources)
+        apply_run_limits(req.cgroup_procs_fd >= 0);
+
+    // Redirect stdin, stdout and stderr
+    dup2(req.stdin_fd, STDIN_FILENO);
+    dup2(req.stdout_fd, STDOUT_FILENO);
+    dup2(req.stderr_fd, STDERR_FILENO);
+
+    // inherit_fd and control_fd/exec_fd are never combined, so fd 3 can't
+    // clobber one of them.
+    if (req.inherit_fd == 3) fcntl(3, F_SETFD, 0);
+    else if (req.inherit_fd >= 0) dup2(req.inherit_fd, 3);
+
+    for (const auto& e : req.env)
+        putenv(const_cast<char*>(e.c_str()));
+
+    if (req.control_fd >= 0) {
+        static char buf[4096];
+        char* argv[64];
+        if (!read_control_args(req.control_fd, buf, sizeof(buf), argv, 64))
+            _exit(0);
+        execvp(argv[0], argv);
+    } else {
         std::vector<char*> cargs;
-        for (const auto& s : args)
+        for (const auto& s : req.args)
             cargs.push_back(const_cast<char*>(s.c_str()));
         cargs.push_back(nullptr);
 
-        execvp(cargs[0], cargs.data());
+        if (req.exec_fd >= 0) fexecve(req.exec_fd, cargs.data(), environ);
+        else execvp(cargs[0], cargs.data());
+    }
 
-        std::cerr << "Internal error: exec failed.\n";
-        _exit(127);
+    // Not std::cerr: it is tied to std::cout and would flush the
+    // server's buffered stdout into the child's output.
+    static const char msg[] = "Internal error: exec failed.\n";
+    ssize_t ignored = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+    (void)ignored;
+    _exit(127);
+}
+
+// Spawns go through a zygote: a helper forked at startup, before the server
+// grows threads, caches and connections. It receives requests over a
+// SOCK_SEQPACKET socket (stdio fds travel as SCM_RIGHTS) and clones with
+// CLONE_PARENT, so the cost of each spawn is set by the zygote's tiny
+// address space while the new process is still the server's own child:
+// waitpid, kill(-pgid) and the rest of the supervision code work unchanged.
+class Zygote {
+public:
+    bool start() {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) return false;
+
+        pid_t server = getpid();
+        pid_t pid = fork();
+        if (pid < 0) {
+            close(sv[0]);
+            close(sv[1]);
+            return false;
+        }
+        if (pid == 0) {
+            close(sv[0]);
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+            if (getppid() != server) _exit(0);
+            serve(sv[1]);
+            _exit(0);
+        }
+
+        close(sv[1]);
+        fd_ = sv[0];
+        return true;
     }
 
-    // ---------------- PARENT ----------------
-    close(stdout_pipe[1]);
-    close(stdin_pipe[0]);
+    // Returns the child's pid, or -1 if the zygote is gone or refused.
+    pid_t spawn(const SpawnRequest& req) {
+        std::string payload = encode(req);
+        std::vector<int> fds = {req.stdin_fd, req.stdout_fd, req.stderr_fd};
+        if (req.cgroup_procs_fd >= 0) fds.push_back(req.cgroup_procs_fd);
+        if (req.control_fd >= 0) fds.push_back(req.control_fd);
+        if (req.inherit_fd >= 0) fds.push_back(req.inherit_fd);
+        if (req.exec_fd >= 0) fds.push_back(req.exec_fd);
+
+        std::lock_guard<std::mutex> lock(m_);
+        if (fd_ < 0) return -1;
+
+        if (!send_with_fds(fd_, payload, fds)) {
+            shut_down_locked();
+            return -1;
+        }
+        int32_t reply = -1;
+        ssize_t n = recv(fd_, &reply, sizeof(reply), 0);
+        if (n != (ssize_t)sizeof(reply)) {
+            shut_down_locked();
+            return -1;
+        }
+        return reply > 0 ? (pid_t)reply : -1;
+    }
+
+private:
+    static constexpr size_t MAX_MESSAGE = 256 * 1024;
+    static constexpr size_t MAX_FDS = 8;
+
+    enum : char {
+        LIMIT_RESOURCES = 1, HAS_CGROUP = 2, HAS_CONTROL = 4, HAS_INHERIT = 8, HAS_EXEC = 16
+    };
+
+    // payload: u8 flags, cwd '\0', each env entry '\0', '\0', then each arg '\0'
+    // fds: stdin, stdout, stderr, then whichever of cgroup.procs, control,
+    // inherit and exec the flags announce, in that order
+    static std::string encode(const SpawnRequest& req) {
+        std::string p;
+        p.push_back((char)((req.limit_resources ? LIMIT_RESOURCES : 0) |
+                           (req.cgroup_procs_fd >= 0 ? HAS_CGROUP : 0) |
+                           (req.control_fd >= 0 ? HAS_CONTROL : 0) |
+                           (req.inherit_fd >= 0 ? HAS_INHERIT : 0) |
+                           (req.exec_fd >= 0 ? HAS_EXEC : 0)));
+        p += req.cwd;
+        p.push_back('\0');
+        for (const auto& e : req.env) {
+            p += e;
+            p.push_back('\0');
+        }
+        p.push_back('\0');
+        for (const auto& a : req.args) {
+            p += a;
+            p.push_back('\0');
+        }
+        return p;
+    }
+
+    static bool decode(const char* data, size_t len, const std::vector<int>& fds, SpawnRequest& req) {
+        if (len < 2) return false;
+        req.limit_resources = (data[0] & LIMIT_RESOURCES) != 0;
+        size_t expected_fds = 3;
+        for (char f : {HAS_CGROUP, HAS_CONTROL, HAS_INHERIT, HAS_EXEC})
+            if (data[0] & f) expected_fds++;
+        if (fds.size() != expected_fds) return false;
+        req.stdin_fd = fds[0];
+        req.stdout_fd = fds[1];
+        req.stderr_fd = fds[2];
+        size_t next_fd = 3;
+        if (data[0] & HAS_CGROUP) req.cgroup_procs_fd = fds[next_fd++];
+        if (data[0] & HAS_CONTROL) req.control_fd = fds[next_fd++];
+        if (data[0] & HAS_INHERIT) req.inherit_fd = fds[next_fd++];
+        if (data[0] & HAS_EXEC) req.exec_fd = fds[next_fd++];
+
+        size_t i = 1;
+        auto next = [&](std::string& out) {
+            const char* end = (const char*)memchr(data + i, '\0', len - i);
+            if (!end) return false;
+            out.assign(data + i, end);
+            i = (size_t)(end - data) + 1;
+            return true;
+        };
+        if (!next(req.cwd)) return false;
+        for (std::string e; next(e) && !e.empty();) req.env.push_back(e);
+        std::string arg;
+        while (i < len && next(arg)) req.args.push_back(arg);
+        return !req.args.empty() || req.control_fd >= 0;
+    }
 
-    // Write input to child
-    if (!input.empty()) {
-        write(stdin_pipe[1], input.c_str(), input.size());
+    static bool send_with_fds(int sock, const std::string& payload, const std::vector<int>& fds) {
+        size_t nfds = fds.size();
+        iovec iov{const_cast<char*>(payload.data()), payload.size()};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cm), fds.data(), sizeof(int) * nfds);
+        return sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t)payload.size();
     }
-    close(stdin_pipe[1]); // Important: signal EOF to child
 
-    auto start = std::chrono::steady_clock::now();
-    bool finished = false;
+    // Zygote main loop. Single-threaded, so the cloned child may allocate.
+    [[noreturn]] static void serve(int sock) {
+        // Keep only stdio and the request socket.
+        for (int fd = 3; fd < 1024; fd++)
+            if (fd != sock) close(fd);
+        signal(SIGCHLD, SIG_DFL);
+
+        std::vector<char> buf(MAX_MESSAGE);
+        for (;;) {
+            iovec iov{buf.data(), buf.size()};
+            alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+            msghdr msg{};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+            if (n <= 0) _exit(0); // server went away
+
+            std::vector<int> fds;
+            for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+                if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+                size_t count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                const int* data = (const int*)CMSG_DATA(cm);
+                fds.insert(fds.end(), data, data + count);
+            }
 
-    while (!finished) {
+            SpawnRequest req;
+            int32_t reply = -EINVAL;
+            if (!(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) &&
+                decode(buf.data(), (size_t)n, fds, req)) {
+                // fork() semantics, but the child's parent is the server.
+                long pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0);
+                if (pid == 0) exec_child(req);
+                reply = pid > 0 ? (int32_t)pid : -errno;
+            }
 
-        // Drain output (non-blocking)
-        char buf[4096];
-        ssize_t n = recv(stdout_pipe[0], buf, sizeof(buf), MSG_DONTWAIT);
-        while (n > 0) {
-            res.output.append(buf, buf + n);
-            n = recv(stdout_pipe[0], buf, sizeof(buf), MSG_DONTWAIT);
+            for (int fd : fds) close(fd);
+            ssize_t ignored = send(sock, &reply, sizeof(reply), MSG_NOSIGNAL);
+            (void)ignored;
         }
+    }
 
-        int status = 0;
-        pid_t w = waitpid(pid, &status, WNOHANG);
+    void shut_down_locked() {
+        if (fd_ >= 0) close(fd_);
+        fd_ = -1;
+        std::cerr << "Zygote unavailable; spawning directly from the server.\n";
+    }
 
-        if (w == pid) {
-            finished = true;
+    std::mutex m_;
+    int fd_ = -1;
+};
 
-            if (WIFEXITED(status))
-                res.exit_code = WEXITSTATUS(status);
-            else if (WIFSIGNALED(status))
-                res.exit_code = 128 + WTERMSIG(status);
+static Zygote g_zygote;
 
-            break;
-        }
+// Spawns through the zygote, falling back to a plain fork when it is gone.
+static pid_t spawn_process(const SpawnRequest& req) {
+    pid_t pid = g_zygote.spawn(req);
+    if (pid > 0) return pid;
 
-        auto now = std::chrono::steady_clock::now();
-        int elapsed_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count();
+    pid = fork();
+    if (pid == 0) exec_child(req);
+    return pid;
+}
 
-        if (elapsed_ms > timeout_ms) {
-            res.timed_out = true;
-            kill(-pid, SIGKILL); // kill whole process group
-            waitpid(pid, nullptr, 0);
-            res.exit_code = 124;
-            finished = true;
-            break;
-        }
+// What a finished child consumed, from wait4() plus our own wall clock.
+// CPU/RSS/fault counters include descendants the child waited for (e.g.
+// cc1plus and ld under g++).
+struct ResourceUsage {
+    double user_ms = 0;
+    double sys_ms = 0;
+    double wall_ms = 0;
+    long max_rss_kb = 0;
+    long minor_faults = 0;
+    long major_faults = 0;
+    long voluntary_switches = 0;
+    long involuntary_switches = 0;
+    // From the job's cgroup (memory.peak, cpu.stat) when it ran in one;
+    // unlike rusage these cover every process and thread of the job.
+    long cgroup_memory_peak_kb = -1;
+    double cgroup_cpu_ms = -1;
+};
+
+struct ProcResult {
+    int exit_code = -1;
+    bool timed_out = false;            // wall-clock deadline hit
+    bool cpu_limit_exceeded = false;   // killed by RLIMIT_CPU
+    bool memory_limit_exceeded = false; // OOM-killed inside its cgroup
+    ResourceUsage usage;
+    std::string output;        // stdout
+    std::string error_output;  // stderr
+    bool truncated = false;    // either stream went past the output cap
+    bool memoized = false;     // replayed from the result cache, not run
+};
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+// Holds at most `cap` bytes of a stream no matter how much is appended:
+// the first half and the most recent half, with a marker in between when
+// something had to be dropped. Used while reading, so a program printing
+// in a tight loop costs a bounded amount of server memory.
+class CappedBuffer {
+public:
+    explicit CappedBuffer(size_t cap = 0)
+        : head_cap_(cap / 2), tail_(cap - cap / 2, '\0') {}
+
+    void append(const char* p, size_t n) {
+        total_ += n;
+        size_t take = std::min(n, head_cap_ - head_.size());
+        head_.append(p, take);
+        p += take;
+        n -= take;
+        if (n == 0 || tail_.empty()) return;
+
+        if (n >= tail_.size()) {
+            memcpy(&tail_[0], p + n - tail_.size(), tail_.size());
+            tail_pos_ = 0;
+            tail_len_ = tail_.size();
+            return;
+        }
+        size_t first = std::min(n, tail_.size() - tail_pos_);
+        memcpy(&tail_[tail_pos_], p, first);
+        memcpy(&tail_[0], p + first, n - first);
+        tail_pos_ = (tail_pos_ + n) % tail_.size();
+        tail_len_ = std::min(tail_.size(), tail_len_ + n);
     }
 
-    // Final drain
-    for (;;) {
-        char buf[4096];
-        ssize_t n = read(stdout_pipe[0], buf, sizeof(buf));
-        if (n <= 0) break;
-        res.output.append(buf, buf + n);
+    bool truncated() const { return total_ > head_.size() + tail_len_; }
+
+    std::string str() const {
+        std::string out = head_;
+        if (truncated()) {
+            out += "\n... [" + std::to_string(total_ - head_.size() - tail_len_)
+                 + " bytes truncated] ...\n";
+        }
+        if (tail_len_ < tail_.size()) {
+            out.append(tail_, 0, tail_len_); // never wrapped
+        } else {
+            out.append(tail_, tail_pos_, std::string::npos);
+            out.append(tail_, 0, tail_pos_);
+        }
+        return out;
     }
 
-    close(stdout_pipe[0]);
+private:
+    size_t head_cap_;
+    std::string head_;
+    std::string tail_;        // ring buffer
+    size_t tail_pos_ = 0;     // next write position
+    size_t tail_len_ = 0;
+    uint64_t total_ = 0;
+};
 
-    return res;
-}
+// ------------------------- Process supervision -------------------------
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+// One thread watches every running child through a single epoll set: a
+// pidfd per child signals its exit, a timerfd fires at its deadline, its
+// stdin pipe is fed whenever it has room and its output pipe is drained as
+// soon as data shows up. All pipe I/O is non-blocking and multiplexed, so a
+// child that writes before reading its input can't deadlock against us,
+// and nothing sleeps or polls on a fixed interval.
+class Supervisor {
+public:
+    // How long the output pipes may stay open after the child exited. Only
+    // processes that left its process group (setsid) can still hold them.
+    static constexpr int EXIT_DRAIN_MS = 100;
+
+    void start() {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        thread_ = std::thread([this] { loop(); });
+        thread_.detach();
+    }
 
-static std::string json_escape(const std::string& s) {
-    std::string out;
-    out.reserve(s.size() + 16);
-    for (char c : s) {
-        switch (c) {
-            case '\\': out += "\\\\"; break;
-            case '"':  out += "\\\""; break;
-            case '\n': out += "\\n"; break;
-            case '\r': out += "\\r"; break;
-            case '\t': out += "\\t"; break;
-            default:
-                if ((unsigned char)c < 0x20) {
-                    // Control chars -> drop
-                } else out += c;
+    // Starts watching `pid`: streams `input` into `in_fd` and collects
+    // `out_fd` and `err_fd`, keeping at most `output_cap` bytes of each; all
+    // three fds are closed by the supervisor. The future becomes ready once
+    // the child has exited and both streams reached EOF, or EXIT_DRAIN_MS
+    // after the exit if something outside the process group still holds
+    // them (the output is then marked truncated). At the deadline the
+    // process group is killed. `kill_job`, if set, kills every process of
+    // the job (its cgroup) at the deadline and when the drain gives up.
+    // `input` must outlive the future.
+    std::future<ProcResult> watch(pid_t pid, int in_fd, const std::string& input,
+                                  int out_fd, int err_fd, size_t output_cap, int timeout_ms,
+                                  bool limit_resources,
+                                  std::chrono::steady_clock::time_point started,
+                                  std::function<void()> kill_job = {}) {
+        auto w = std::make_shared<Watch>();
+        w->pid = pid;
+        w->kill_job = std::move(kill_job);
+        w->limit_resources = limit_resources;
+        w->started = started;
+        w->in_fd = in_fd;
+        w->input = &input;
+        w->out = Stream{out_fd, CappedBuffer(output_cap)};
+        w->err = Stream{err_fd, CappedBuffer(output_cap)};
+        fcntl(in_fd, F_SETFL, fcntl(in_fd, F_GETFL) | O_NONBLOCK);
+        fcntl(out_fd, F_SETFL, fcntl(out_fd, F_GETFL) | O_NONBLOCK);
+        fcntl(err_fd, F_SETFL, fcntl(err_fd, F_GETFL) | O_NONBLOCK);
+
+        // Without pidfd (pre-5.3 kernels) fall back to a 10 ms ticker that
+        // checks on the child; the rest of the machinery is the same.
+        w->exit_fd = (int)syscall(SYS_pidfd_open, pid, 0);
+        if (w->exit_fd < 0) {
+            w->exit_is_ticker = true;
+            w->exit_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            itimerspec tick{{0, 10000000}, {0, 10000000}};
+            timerfd_settime(w->exit_fd, 0, &tick, nullptr);
+        } else {
+            fcntl(w->exit_fd, F_SETFD, FD_CLOEXEC);
         }
+
+        w->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        itimerspec deadline{};
+        deadline.it_value.tv_sec = timeout_ms / 1000;
+        deadline.it_value.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+        timerfd_settime(w->timer_fd, 0, &deadline, nullptr);
+
+        std::future<ProcResult> done = w->done.get_future();
+
+        // Holding the lock keeps the loop from acting on (and closing) this
+        // watch before all of its fds are registered.
+        std::lock_guard<std::mutex> lock(m_);
+        uint64_t id = next_id_++;
+        watches_[id] = w;
+        add(w->out.fd, id, OUT, EPOLLIN);
+        add(w->err.fd, id, ERR, EPOLLIN);
+        add(w->exit_fd, id, EXIT, EPOLLIN);
+        add(w->timer_fd, id, TIMER, EPOLLIN);
+        if (input.empty()) close_stdin(*w); // EOF right away
+        else add(w->in_fd, id, IN, EPOLLOUT);
+        return done;
     }
-    return out;
-}
 
-static std::string handle_run_cpp(const std::string& code,
-                                  const std::string& input)
-{
-    namespace fs = std::filesystem;
+private:
+    enum Kind : uint64_t { OUT = 0, ERR = 1, EXIT = 2, TIMER = 3, IN = 4 };
+
+    struct Stream {
+        int fd = -1;
+        CappedBuffer data;
+        bool closed = false;
+    };
+
+    struct Watch {
+        pid_t pid = -1;
+        int in_fd = -1;
+        const std::string* input = nullptr;
+        size_t in_off = 0;
+        Stream out;
+        Stream err;
+        int exit_fd = -1;
+        int timer_fd = -1;
+        bool exit_is_ticker = false;
+        bool limit_resources = false;
+        std::chrono::steady_clock::time_point started;
+        bool exited = false;
+        bool abandoned = false;    // gave up on output held by escaped processes
+        std::function<void()> kill_job;
+        ProcResult res;
+        std::promise<ProcResult> done;
+    };
+
+    void add(int fd, uint64_t id, Kind kind, uint32_t events) {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.u64 = (id << 3) | kind;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+    }
 
-    fs::create_directories("user_codes");
+    void loop() {
+        epoll_event events[64];
+        for (;;) {
+            int n = epoll_wait(epoll_fd_, events, 64, -1);
+            for (int i = 0; i < n; i++) {
+                uint64_t id = events[i].data.u64 >> 3;
+                Kind kind = (Kind)(events[i].data.u64 & 7);
+
+                std::shared_ptr<Watch> w;
+                {
+                    std::lock_guard<std::mutex> lock(m_);
+                    auto it = watches_.find(id);
+                    if (it == watches_.end()) continue; // finished earlier in this batch
+                    w = it->second;
+                }
 
-    std::string source_path = "user_codes/temp.cpp";
-    std::string binary_path = "user_codes/temp.out";
+                if (kind == OUT) drain(w->out);
+                else if (kind == ERR) drain(w->err);
+                else if (kind == IN) feed(*w);
+                else if (kind == EXIT) check_exit(*w);
+                else on_timer(*w);
 
-    // 1️⃣ Write source file
-    {
-        std::ofstream out(source_path);
-        if (!out) {
-            return R"({"ok":false,"error":"Failed to write source file"})";
+                if (w->exited && w->out.closed && w->err.closed) finish(id, *w);
+            }
         }
-        out << code;
     }
 
-    // 2️⃣ Compile
-    ProcResult compile = run_process_capture(
-        {"g++", source_path, "-std=c++17", "-O2", "-o", binary_path},
-        "",
-        5000,
-        false
-    );
+    void drain(Stream& s) {
+        if (s.closed) return;
+        char buf[16384];
+        for (;;) {
+            ssize_t n = read(s.fd, buf, sizeof(buf));
+            if (n > 0) {
+                s.data.append(buf, (size_t)n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            s.closed = true;
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, s.fd, nullptr);
+            return;
+        }
+    }
 
-    if (compile.exit_code != 0) {
-        return std::string("{\"ok\":false,\"stage\":\"compile\",\"output\":\"")
-            + json_escape(compile.output) + "\"}";
+    void feed(Watch& w) {
+        while (w.in_fd >= 0 && w.in_off < w.input->size()) {
+            ssize_t n = write(w.in_fd, w.input->data() + w.in_off, w.input->size() - w.in_off);
+            if (n > 0) {
+                w.in_off += (size_t)n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            break; // EPIPE: the child closed stdin or died; the rest is moot
+        }
+        close_stdin(w); // everything written: signal EOF to the child
     }
 
-    // 3️⃣ Run
-    ProcResult run = run_process_capture(
-        {binary_path},
-        input,
-        2000,
-        true   // apply resource limits
-    );
+    void close_stdin(Watch& w) {
+        if (w.in_fd < 0) return;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, w.in_fd, nullptr);
+        close(w.in_fd);
+        w.in_fd = -1;
+    }
 
-    std::string json = "{";
-    json += "\"ok\":true,";
-    json += "\"exit_code\":" + std::to_string(run.exit_code) + ",";
-    json += "\"timed_out\":" + std::string(run.timed_out ? "true" : "false") + ",";
-    json += "\"output\":\"" + json_escape(run.output) + "\"";
-    json += "}";
+    void check_exit(Watch& w) {
+        if (w.exit_is_ticker) {
+            uint64_t ticks;
+            ssize_t ignored = read(w.exit_fd, &ticks, sizeof(ticks));
+            (void)ignored;
+        }
+        if (w.exited) return;
 
-    return json;
-}
+        // WNOWAIT: look, don't reap yet. While the child is a zombie its pid
+        // (and so its process group id) can't be reused, which makes the
+        // group kill below safe.
+        siginfo_t info{};
+        if (waitid(P_PID, (id_t)w.pid, &info, WEXITED | WNOHANG | WNOWAIT) != 0 || info.si_pid == 0)
+            return;
 
-static std::string handle_run_nan(const std::string& program)
-{
-    std::string binary_path = "user_codes/temp.out"; 
-    // change path if needed
+        // Stragglers left in the group would hold the output pipe open.
+        kill(-w.pid, SIGKILL);
 
-    if (!std::filesystem::exists(binary_path)) {
-        return R"({"ok":false,"error":"nan_interpreter binary not found"})";
+        int status = 0;
+        struct rusage ru{};
+        wait4(w.pid, &status, 0, &ru);
+        record_usage(w, ru);
+        if (!w.res.timed_out) {
+            if (WIFEXITED(status))
+                w.res.exit_code = WEXITSTATUS(status);
+            else if (WIFSIGNALED(status))
+                w.res.exit_code = 128 + WTERMSIG(status);
+
+            // RLIMIT_CPU sends SIGXCPU at the soft limit and SIGKILL past the
+            // hard one (if SIGXCPU was caught); both mean "used too much CPU",
+            // not "ran too long".
+            double cpu_ms = w.res.usage.user_ms + w.res.usage.sys_ms;
+            w.res.cpu_limit_exceeded = w.limit_resources && WIFSIGNALED(status) &&
+                (WTERMSIG(status) == SIGXCPU ||
+                 (WTERMSIG(status) == SIGKILL && cpu_ms >= (RUN_CPU_LIMIT_SECONDS + 1) * 1000.0));
+        }
+        w.exited = true;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, w.exit_fd, nullptr);
+        close_stdin(w);
+        drain(w.out);
+        drain(w.err);
+
+        // Re-arm the timer (deadline no longer matters) as a short grace
+        // period for the pipes to reach EOF.
+        if (!w.out.closed || !w.err.closed) {
+            itimerspec grace{};
+            grace.it_value.tv_nsec = EXIT_DRAIN_MS * 1000000L;
+            timerfd_settime(w.timer_fd, 0, &grace, nullptr);
+        }
     }
 
-    ProcResult run = run_process_capture(
-        {binary_path},
-        program,   // send script via stdin
-        2000,
-        true       // apply resource limits
-    );
+    static void record_usage(Watch& w, const struct rusage& ru) {
+        auto ms = [](const timeval& tv) { return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0; };
+        ResourceUsage& u = w.res.usage;
+        u.user_ms = ms(ru.ru_utime);
+        u.sys_ms = ms(ru.ru_stime);
+        u.wall_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - w.started).count();
+        u.max_rss_kb = ru.ru_maxrss;
+        u.minor_faults = ru.ru_minflt;
+        u.major_faults = ru.ru_majflt;
+        u.voluntary_switches = ru.ru_nvcsw;
+        u.involuntary_switches = ru.ru_nivcsw;
+    }
 
-    std::string json = "{";
-    json += "\"ok\":true,";
-    json += "\"exit_code\":" + std::to_string(run.exit_code) + ",";
-    json += "\"timed_out\":" + std::string(run.timed_out ? "true" : "false") + ",";
-    json += "\"output\":\"" + json_escape(run.output) + "\"";
-    json += "}";
+    // Before the exit the timer is the deadline, after it the drain period.
+    void on_timer(Watch& w) {
+        uint64_t expirations = 0;
+        if (read(w.timer_fd, &expirations, sizeof(expirations)) <= 0)
+            return; // re-armed after this event was queued
+
+        if (!w.exited) {
+            if (w.res.timed_out) return;
+            w.res.timed_out = true;
+            w.res.exit_code = 124;
+            kill(-w.pid, SIGKILL); // kill whole process group
+            if (w.kill_job) w.kill_job();
+            return;
+        }
 
-    return json;
-}
+        // Whatever still holds the pipes escaped the process group.
+        if (w.kill_job) w.kill_job();
+        for (Stream* s : {&w.out, &w.err}) {
+            drain(*s);
+            if (s->closed) continue;
+            s->closed = true;
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, s->fd, nullptr);
+            w.abandoned = true;
+        }
+    }
 
+    void finish(uint64_t id, Watch& w) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, w.timer_fd, nullptr);
+        close(w.exit_fd);
+        close(w.timer_fd);
+        // Closing the read ends also hands SIGPIPE to any writer left.
+        close(w.out.fd);
+        close(w.err.fd);
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            watches_.erase(id);
+        }
+        w.res.output = w.out.data.str();
+        w.res.error_output = w.err.data.str();
+        w.res.truncated = w.out.data.truncated() || w.err.data.truncated() || w.abandoned;
+        w.done.set_value(std::move(w.res));
+    }
 
+    int epoll_fd_ = -1;
+    std::thread thread_;
+    std::mutex m_;
+    uint64_t next_id_ = 0;
+    std::unordered_map<uint64_t, std::shared_ptr<Watch>> watches_;
+};
 
-// ------------------------- Main server -------------------------
+static Supervisor g_supervisor;
 
-int main() {
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) {
-        perror("socket");
-        return 1;
-    }
+constexpr int PIPE_BUFFER_SIZE = 1024 * 1024;
 
-    int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+// ------------------------- cgroup v2 -------------------------
 
-    sockaddr_in address{};
-    address.sin_family = AF_INET;
-    address.sin_port = htons(PORT);
-    // Bind to localhost only for safety
-    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+static bool write_text(const std::string& path, const std::string& text) {
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool ok = write(fd, text.data(), text.size()) == (ssize_t)text.size();
+    close(fd);
+    return ok;
+}
 
-    if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
-        perror("bind");
-        close(server_fd);
-        return 1;
+// A transient cgroup for one sandboxed run. Removing it kills anything the
+// program left behind, including processes that escaped its process group.
+class JobCgroup {
+public:
+    JobCgroup(std::string path, int procs_fd) : path_(std::move(path)), procs_fd_(procs_fd) {}
+
+    ~JobCgroup() {
+        close(procs_fd_);
+        kill();
+        // Killed tasks leave the group asynchronously; rmdir fails with
+        // EBUSY until the last one is gone.
+        for (int i = 0; i < 100 && rmdir(path_.c_str()) != 0 && errno == EBUSY; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
 
-    if (listen(server_fd, 16) < 0) {
-        perror("listen");
-        close(server_fd);
-        return 1;
-    }
+    JobCgroup(const JobCgroup&) = delete;
+    JobCgroup& operator=(const JobCgroup&) = delete;
 
-    std::cout << "Server running on http://127.0.0.1:" << PORT << "\n";
+    int procs_fd() const { return procs_fd_; }
 
-    while (true) {
-        sockaddr_in client{};
-        socklen_t client_len = sizeof(client);
-        int client_fd = accept(server_fd, (struct sockaddr*)&client, &client_len);
-        if (client_fd < 0) continue;
+    // SIGKILLs every process in the job, wherever its process group is.
+    void kill() const { write_text(path_ + "/cgroup.kill", "1"); }
+
+    // Reads the job's accounting once it has finished.
+    void collect(ProcResult& res) const {
+        std::string peak = trim(read_file(path_ + "/memory.peak"));
+        if (!peak.empty()) res.usage.cgroup_memory_peak_kb = std::atol(peak.c_str()) / 1024;
+
+        std::istringstream cpu(read_file(path_ + "/cpu.stat"));
+        std::string key;
+        long long value;
+        while (cpu >> key >> value)
+            if (key == "usage_usec") res.usage.cgroup_cpu_ms = value / 1000.0;
+
+        std::istringstream events(read_file(path_ + "/memory.events"));
+        while (events >> key >> value)
+            if (key == "oom_kill" && value > 0) res.memory_limit_exceeded = true;
+    }
 
-        std::string raw = read_http_from_socket(client_fd);
-        auto req_opt = parse_http_request(raw);
+private:
+    std::string path_;
+    int procs_fd_;
+};
 
-        if (!req_opt) {
-            auto resp = http_response(400, "Bad Request", "text/plain; charset=utf-8",
-                                      "Bad Request\n");
-            send_all(client_fd, resp);
-            close(client_fd);
-            continue;
+// Owns a delegated cgroup v2 subtree. At startup the server moves itself
+// into a leaf (`server`) so its own cgroup can enable controllers for
+// children, then every sandboxed run gets `job-N` with memory.max, cpu.max,
+// pids.max and an io weight. Unlike RLIMIT_AS this limits real memory use
+// and covers every thread and child of the program.
+//
+// When cgroup v2 isn't mounted, isn't writable or the subtree can't be
+// delegated (other processes share our cgroup), this stays disabled and
+// runs fall back to rlimits alone.
+class CgroupManager {
+public:
+    bool init(bool wanted, uint64_t memory_max, uint32_t cpu_max_percent, uint32_t pids_max) {
+        if (!wanted) return false;
+        if (access("/sys/fs/cgroup/cgroup.controllers", R_OK) != 0) return false;
+
+        std::string self;
+        std::istringstream in(read_file("/proc/self/cgroup"));
+        for (std::string line; std::getline(in, line);)
+            if (line.rfind("0::", 0) == 0) self = line.substr(3);
+        if (self.empty()) return false;
+        std::string base = "/sys/fs/cgroup" + (self == "/" ? std::string() : self);
+
+        // Move out of `base` so it has no processes of its own; that is
+        // what allows enabling controllers in base/cgroup.subtree_control.
+        std::string leaf = base + "/webcpp-server";
+        if (mkdir(leaf.c_str(), 0755) != 0 && errno != EEXIST) return false;
+        if (!write_text(leaf + "/cgroup.procs", std::to_string(getpid()))) return false;
+
+        for (const char* c : {"+memory", "+cpu", "+pids"}) {
+            if (!write_text(base + "/cgroup.subtree_control", c)) {
+                std::cerr << "cgroup: cannot enable " << c + 1 << " in " << base << "\n";
+                return false;
+            }
         }
+        write_text(base + "/cgroup.subtree_control", "+io"); // optional
 
-        HttpRequest req = *req_opt;
+        root_ = base;
+        memory_max_ = memory_max;
+        cpu_max_percent_ = cpu_max_percent;
+        pids_max_ = pids_max;
+        return true;
+    }
 
-        std::string path, query;
-        split_path_query(req.path, path, query);
-        auto params = parse_query(query);
+    bool enabled() const { return !root_.empty(); }
 
-        // ensure folder exists
-        std::filesystem::create_directories("user_codes");
+    std::unique_ptr<JobCgroup> create_job() {
+        std::string path = root_ + "/job-" + std::to_string(getpid()) + "-" + std::to_string(next_id_++);
+        if (mkdir(path.c_str(), 0755) != 0) return nullptr;
 
+        bool ok = write_text(path + "/memory.max", std::to_string(memory_max_)) &&
+                  write_text(path + "/cpu.max", std::to_string(cpu_max_percent_ * 1000) + " 100000") &&
+                  write_text(path + "/pids.max", std::to_string(pids_max_));
+        write_text(path + "/memory.swap.max", "0");   // absent without swap accounting
+        write_text(path + "/io.weight", "default 50"); // absent without the io controller
 
-        if (req.method == "GET" && (req.path == "/" || req.path == "/index.html")) {
-            std::string content = read_file("public/index.html");
-            if (content.empty()) {
-                auto resp = http_response(404, "Not Found", "text/plain; charset=utf-8",
-                                          "public/index.html not found.\n");
-                send_all(client_fd, resp);
-            } else {
-                auto resp = http_response(200, "OK", "text/html; charset=utf-8", content);
-                send_all(client_fd, resp);
-            }
+        int procs_fd = ok ? open((path + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC) : -1;
+        if (procs_fd < 0) {
+            rmdir(path.c_str());
+            return nullptr;
         }
-else if (req.method == "POST" && req.path == "/run") {
-    try {
-        auto j = json::parse(req.body);
+        return std::make_unique<JobCgroup>(path, procs_fd);
+    }
+
+private:
+    std::string root_;
+    uint64_t memory_max_ = 0;
+    uint32_t cpu_max_percent_ = 100;
+    uint32_t pids_max_ = 64;
+    std::atomic<uint64_t> next_id_{0};
+};
 
-        std::string code  = j.value("code", "");
-        std::string input = j.value("input", "");
+static CgroupManager g_cgroups;
 
-        if (code.empty()) {
-            auto resp = http_response(400, "Bad Request",
-                "application/json; charset=utf-8",
-                R"({"ok":false,"error":"Missing 'code'"})");
-            send_all(client_fd, resp);
-            close(client_fd);
-            continue;
-        }
+// Spawns `spawn` (args, cwd, limits and any extra fds; the stdio fields are
+// filled in here), feeds it `input` and collects its output.
+static ProcResult run_process_capture(SpawnRequest spawn,
+                                      const std::string& input,
+                                      int timeout_ms)
+{
+    ProcResult res;
+    bool limit_resources = spawn.limit_resources;
 
-        std::string out_json = handle_run_cpp(code, input);
+    int stdout_pipe[2];
+    int stderr_pipe[2];
+    int stdin_pipe[2];
 
-        auto resp = http_response(200, "OK",
-            "application/json; charset=utf-8", out_json);
-        send_all(client_fd, resp);
+    // O_CLOEXEC: concurrent spawns must not leak each other's pipe ends
+    // (or client sockets) into unrelated children.
+    if (pipe2(stdout_pipe, O_CLOEXEC) != 0) {
+        res.output = "Internal error: pipe() failed.\n";
+        return res;
     }
-    catch (const std::exception& e) {
-        std::string err = std::string("{\"ok\":false,\"error\":\"Invalid JSON: ")
-                        + json_escape(e.what()) + "\"}";
-        auto resp = http_response(400, "Bad Request",
-            "application/json; charset=utf-8", err);
-        send_all(client_fd, resp);
+    if (pipe2(stderr_pipe, O_CLOEXEC) != 0) {
+        close(stdout_pipe[0]); close(stdout_pipe[1]);
+        res.output = "Internal error: pipe() failed.\n";
+        return res;
+    }
+    if (pipe2(stdin_pipe, O_CLOEXEC) != 0) {
+        close(stdout_pipe[0]); close(stdout_pipe[1]);
+        close(stderr_pipe[0]); close(stderr_pipe[1]);
+        res.output = "Internal error: pipe() failed.\n";
+        return res;
     }
-}
 
-        else if (req.method == "GET" && path == "/load") {
-            std::string name = params.count("name") ? params["name"] : "star_code.cpp";
-            auto safe = sanitize_cpp_filename(name);
-            if (!safe) {
-                auto resp = http_response(400, "Bad Request", "text/plain; charset=utf-8",
-                                        "Invalid filename. Use something like star_code.cpp\n");
-                send_all(client_fd, resp);
-            } else {
-                std::string full = "user_codes/" + *safe;
-                std::string content = read_file(full);
-                if (content.empty() && !std::filesystem::exists(full)) {
-                    auto resp = http_response(404, "Not Found", "text/plain; charset=utf-8",
-                                            ("File not found: " + full + "\n"));
-                    send_all(client_fd, resp);
-                } else {
-                    auto resp = http_response(200, "OK", "text/plain; charset=utf-8", content);
-                    send_all(client_fd, resp);
-                }
-            }
-        }
+    // Bigger pipes mean fewer wakeups per megabyte of test input/output.
+    // Best effort: the kernel caps this at /proc/sys/fs/pipe-max-size.
+    fcntl(stdin_pipe[1], F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+    fcntl(stdout_pipe[0], F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
 
-        else if (req.method == "POST" && path == "/run-nan") {
-    try {
-        auto j = json::parse(req.body);
-
-        std::string program = j.value("program", "");
-
-        if (program.empty()) {
-            auto resp = http_response(400, "Bad Request",
-                "application/json; charset=utf-8",
-                R"({"ok":false,"error":"Missing 'program'"})");
-            send_all(client_fd, resp);
-            close(client_fd);
-            continue;
-        }
-
-        std::string out_json = handle_run_nan(program);
-
-        auto resp = http_response(200, "OK",
-            "application/json; charset=utf-8", out_json);
-        send_all(client_fd, resp);
-    }
-    catch (const std::exception& e) {
-        std::string err = std::string("{\"ok\":false,\"error\":\"Invalid JSON: ")
-                        + json_escape(e.what()) + "\"}";
-        auto resp = http_response(400, "Bad Request",
-            "application/json; charset=utf-8", err);
-        send_all(client_fd, resp);
-    }
-}
-        
-        
-        else if (req.method == "POST" && path == "/save") {
-            std::string name = params.count("name") ? params["name"] : "star_code.cpp";
-            auto safe = sanitize_cpp_filename(name);
-            if (!safe) {
-                auto resp = http_response(400, "Bad Request", "application/json; charset=utf-8",
-                                        R"({"ok":false,"error":"Invalid filename. Use something like star_code.cpp"})");
-                send_all(client_fd, resp);
-            } else {
-                std::string full = "user_codes/" + *safe;
-                std::ofstream out(full, std::ios::binary);
-                if (!out) {
-                    auto resp = http_response(500, "Internal Server Error", "application/json; charset=utf-8",
-                                            R"({"ok":false,"error":"Failed to open file for writing."})");
-                    send_all(client_fd, resp);
-                } else {
-                    out << req.body;
-                    out.close();
-                    std::string body = std::string("{\"ok\":true,\"savedAs\":\"") + json_escape(*safe) +
-                                    "\",\"bytes\":" + std::to_string(req.body.size()) + "}";
-                    auto resp = http_response(200, "OK", "application/json; charset=utf-8", body);
-                    send_all(client_fd, resp);
-                }
-            }
-        }
+    spawn.stdin_fd = stdin_pipe[0];
+    spawn.stdout_fd = stdout_pipe[1];
+    spawn.stderr_fd = stderr_pipe[1];
 
-        else {
-            auto resp = http_response(404, "Not Found", "text/plain; charset=utf-8",
-                                      "Not Found\n");
-            send_all(client_fd, resp);
-        }
+    std::unique_ptr<JobCgroup> cgroup;
+    if (limit_resources && g_cgroups.enabled()) {
+        cgroup = g_cgroups.create_job();
+        if (cgroup) spawn.cgroup_procs_fd = cgroup->procs_fd();
+    }
 
-        close(client_fd);
+    auto started = std::chrono::steady_clock::now();
+    pid_t pid = spawn_process(spawn);
+    if (pid < 0) {
+        close(stdout_pipe[0]); close(stdout_pipe[1]);
+        close(stderr_pipe[0]); close(stderr_pipe[1]);
+        close(stdin_pipe[0]);  close(stdin_pipe[1]);
+        res.output = "Internal error: fork() failed.\n";
+        return res;
     }
 
+    // ---------------- PARENT ----------------
+    close(stdout_pipe[1]);
+    close(stderr_pipe[1]);
+    close(stdin_pipe[0]);
+
+    // Stdin is fed and output drained by the supervisor, interleaved as
+    // the child makes room or produces data; it closes all three pipe ends.
+    std::function<void()> kill_job;
+    if (cgroup) kill_job = [job = cgroup.get()] { job->kill(); };
+    res = g_supervisor.watch(pid, stdin_pipe[1], input, stdout_pipe[0], stderr_pipe[0],
+                             g_config.output_cap, timeout_ms, limit_resources, started,
+                             std::move(kill_job)).get();
+    if (cgroup) cgroup->collect(res);
+
+    return res;
+}
+
+static ProcResult run_process_capture(
+    const std::vector<std::string>& args,
+    const std::string& input,
+    int timeout_ms,
+    bool limit_resources,
+    const std::string& cwd = "")
+{
+    SpawnRequest spawn;
+    spawn.args = args;
+    spawn.cwd = cwd;
+    spawn.limit_resources = limit_resources;
+    return run_process_capture(std::move(spawn), input, timeout_ms);
+}
+
+static std::string json_escape(const std::string& s) {
+    std::string out;
+    out.reserve(s.size() + 16);
+    for (char c : s) {
+        switch (c) {
+            case '\\': out += "\\\\"; break;
+            case '"':  out += "\\\""; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    // Control chars -> drop
+                } else out += c;
+        }
+    }
+    return out;
+}
+
+// ------------------------- Workspaces -------------------------
+
+// Each job compiles and runs inside its own scratch directory, so any number
+// of jobs can be in flight at once. Directories live on tmpfs when one is
+// available (and allows exec), are handed out from a free list, and are
+// emptied by a background thread after the job lets go of them.
+class WorkspacePool {
+public:
+    ~WorkspacePool() {
+        if (!cleaner_.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        cleaner_.join();
+    }
+
+    void init(size_t max_idle) {
+        namespace fs = std::filesystem;
+        max_idle_ = max_idle;
+
+        const char* configured = std::getenv("WEBCPP_WORKSPACE_ROOT");
+        std::string base = configured && *configured ? configured
+                         : tmpfs_usable("/dev/shm") ? "/dev/shm"
+                         : fs::absolute("user_codes").string();
+        root_ = base + "/.webcpp-work-" + std::to_string(getpid());
+
+        std::error_code ec;
+        fs::remove_all(root_, ec);
+        fs::create_directories(root_);
+        cleaner_ = std::thread([this] { clean_loop(); });
+    }
+
+    const std::string& root() const { return root_; }
+
+    std::string acquire() {
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            if (!idle_.empty()) {
+                std::string dir = std::move(idle_.back());
+                idle_.pop_back();
+                return dir;
+            }
+        }
+        std::string dir = root_ + "/ws-" + std::to_string(next_id_++);
+        std::filesystem::create_directories(dir);
+        return dir;
+    }
+
+    void release(std::string dir) {
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            dirty_.push_back(std::move(dir));
+        }
+        cv_.notify_one();
+    }
+
+private:
+    // /dev/shm is often mounted noexec in containers; binaries there would
+    // fail with EACCES, so only use it when exec is allowed.
+    static bool tmpfs_usable(const char* path) {
+        struct statvfs sv{};
+        if (statvfs(path, &sv) != 0) return false;
+        if (sv.f_flag & ST_NOEXEC) return false;
+        return access(path, W_OK | X_OK) == 0;
+    }
+
+    void clean_loop() {
+        namespace fs = std::filesystem;
+        for (;;) {
+            std::string dir;
+            {
+                std::unique_lock<std::mutex> lock(m_);
+                cv_.wait(lock, [this] { return stop_ || !dirty_.empty(); });
+                if (dirty_.empty()) return;
+                dir = std::move(dirty_.front());
+                dirty_.pop_front();
+            }
+
+            std::error_code ec;
+            for (auto& entry : fs::directory_iterator(dir, ec))
+                fs::remove_all(entry.path(), ec);
+
+            std::lock_guard<std::mutex> lock(m_);
+            if (idle_.size() < max_idle_) idle_.push_back(std::move(dir));
+            else fs::remove_all(dir, ec);
+        }
+    }
+
+    std::string root_;
+    size_t max_idle_ = 0;
+    std::atomic<size_t> next_id_{0};
+
+    std::mutex m_;
+    std::condition_variable cv_;
+    std::vector<std::string> idle_;
+    std::deque<std::string> dirty_;
+    bool stop_ = false;
+    std::thread cleaner_;
+};
+
+static WorkspacePool g_workspaces;
+
+// Scratch directory for the lifetime of one job.
+struct Workspace {
+    std::string dir = g_workspaces.acquire();
+
+    Workspace() = default;
+    ~Workspace() { g_workspaces.release(std::move(dir)); }
+    Workspace(const Workspace&) = delete;
+    Workspace& operator=(const Workspace&) = delete;
+
+    std::string path(const std::string& name) const { return dir + "/" + name; }
+};
+
+// ------------------------- Sandbox pool -------------------------
+
+// A sandboxed process that has already been spawned, moved into its own
+// cgroup and scratch directory, limited and wired to its pipes, and is now
+// blocked reading its control pipe. Starting a run is then a single write
+// of the argv; everything expensive happened ahead of time.
+struct SandboxSlot {
+    pid_t pid = -1;
+    int control_fd = -1;        // write end; closing it without a command retires the slot
+    int stdin_fd = -1;          // parent ends of the slot's stdio pipes
+    int stdout_fd = -1;
+    int stderr_fd = -1;
+    std::string dir;
+    std::unique_ptr<JobCgroup> cgroup;
+    std::chrono::steady_clock::time_point created;
+
+    SandboxSlot() = default;
+    SandboxSlot(const SandboxSlot&) = delete;
+    SandboxSlot& operator=(const SandboxSlot&) = delete;
+
+    ~SandboxSlot() {
+        for (int fd : {control_fd, stdin_fd, stdout_fd, stderr_fd})
+            if (fd >= 0) close(fd);
+        // Still waiting: EOF on the control pipe makes it exit on its own;
+        // the kill covers one that is stuck.
+        if (pid > 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+        cgroup.reset();
+        if (!dir.empty()) g_workspaces.release(std::move(dir));
+    }
+
+    // Still blocked on its control pipe? (It may have been OOM-killed or
+    // otherwise died while idle.) WNOWAIT leaves the zombie for ~SandboxSlot.
+    bool alive() const {
+        siginfo_t info{};
+        return waitid(P_PID, (id_t)pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == 0;
+    }
+};
+
+// Keeps a number of SandboxSlots ready for user programs. A background
+// thread refills the pool, retires slots that died or sat idle too long,
+// and sizes it from an EWMA of the acquisition rate: enough slots to cover
+// the runs expected while a replacement is being prepared, between the
+// configured minimum and maximum. Every slot is used for exactly one run;
+// its workspace and cgroup go back to their own pools afterwards.
+class SandboxPool {
+public:
+    ~SandboxPool() {
+        if (!thread_.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+
+    void init(size_t min_slots, size_t max_slots) {
+        min_ = std::min(min_slots, max_slots);
+        max_ = max_slots;
+        target_ = min_;
+        if (max_ == 0) return;
+        thread_ = std::thread([this] { maintain(); });
+    }
+
+    // A ready slot, or nullptr when the pool is empty or disabled (the
+    // caller then spawns the classic way).
+    std::unique_ptr<SandboxSlot> acquire() {
+        std::vector<std::unique_ptr<SandboxSlot>> dead;
+        std::unique_ptr<SandboxSlot> slot;
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            acquisitions_++;
+            while (!idle_.empty() && !slot) {
+                std::unique_ptr<SandboxSlot> s = std::move(idle_.back());
+                idle_.pop_back();
+                if (s->alive()) slot = std::move(s);
+                else dead.push_back(std::move(s));
+            }
+            if (!slot) misses_++;
+        }
+        cv_.notify_one();
+        return slot;   // `dead` is torn down outside the lock
+    }
+
+private:
+    static constexpr auto TICK = std::chrono::milliseconds(100);
+    static constexpr auto MAX_IDLE_AGE = std::chrono::seconds(60);
+    // Slots to keep per run/second of demand: roughly how long it takes
+    // to prepare a replacement, with headroom for bursts.
+    static constexpr double REFILL_WINDOW_S = 0.25;
+
+    static std::unique_ptr<SandboxSlot> create() {
+        auto slot = std::make_unique<SandboxSlot>();
+        int in[2], out[2], err[2], control[2];
+        if (pipe2(in, O_CLOEXEC) != 0) return nullptr;
+        if (pipe2(out, O_CLOEXEC) != 0) {
+            close(in[0]); close(in[1]);
+            return nullptr;
+        }
+        if (pipe2(err, O_CLOEXEC) != 0) {
+            close(in[0]); close(in[1]); close(out[0]); close(out[1]);
+            return nullptr;
+        }
+        if (pipe2(control, O_CLOEXEC) != 0) {
+            close(in[0]); close(in[1]); close(out[0]); close(out[1]); close(err[0]); close(err[1]);
+            return nullptr;
+        }
+        fcntl(in[1], F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+        fcntl(out[0], F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+        slot->stdin_fd = in[1];
+        slot->stdout_fd = out[0];
+        slot->stderr_fd = err[0];
+        slot->control_fd = control[1];
+        slot->dir = g_workspaces.acquire();
+
+        SpawnRequest spawn;
+        spawn.cwd = slot->dir;
+        spawn.limit_resources = true;
+        spawn.stdin_fd = in[0];
+        spawn.stdout_fd = out[1];
+        spawn.stderr_fd = err[1];
+        spawn.control_fd = control[0];
+        if (g_cgroups.enabled()) {
+            slot->cgroup = g_cgroups.create_job();
+            if (slot->cgroup) spawn.cgroup_procs_fd = slot->cgroup->procs_fd();
+        }
+
+        slot->pid = spawn_process(spawn);
+        for (int fd : {in[0], out[1], err[1], control[0]}) close(fd);
+        if (slot->pid < 0) return nullptr;
+        slot->created = std::chrono::steady_clock::now();
+        return slot;
+    }
+
+    void maintain() {
+        auto window_start = std::chrono::steady_clock::now();
+        double rate_ewma = 0;
+
+        std::unique_lock<std::mutex> lock(m_);
+        while (!stop_) {
+            cv_.wait_for(lock, TICK);
+            if (stop_) break;
+
+            auto now = std::chrono::steady_clock::now();
+            double elapsed = std::chrono::duration<double>(now - window_start).count();
+            if (elapsed >= 1.0) {
+                double rate = acquisitions_ / elapsed;
+                rate_ewma = rate_ewma == 0 ? rate : 0.7 * rate_ewma + 0.3 * rate;
+                acquisitions_ = 0;
+                window_start = now;
+            }
+            // A miss means demand outran the pool: grow now rather than
+            // waiting for the rate estimate to catch up.
+            size_t wanted = min_ + (size_t)(rate_ewma * REFILL_WINDOW_S + 0.999) + misses_;
+            target_ = std::clamp(wanted, min_, max_);
+            misses_ = 0;
+
+            std::vector<std::unique_ptr<SandboxSlot>> retired;
+            for (auto it = idle_.begin(); it != idle_.end();) {
+                if (now - (*it)->created > MAX_IDLE_AGE || !(*it)->alive()) {
+                    retired.push_back(std::move(*it));
+                    it = idle_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            while (idle_.size() > target_) {
+                retired.push_back(std::move(idle_.front()));   // oldest first
+                idle_.pop_front();
+            }
+
+            // Spawning and teardown go through the zygote and the
+            // filesystem; don't hold up acquire() meanwhile.
+            size_t missing = target_ > idle_.size() ? target_ - idle_.size() : 0;
+            lock.unlock();
+            retired.clear();
+            for (; missing > 0; missing--) {
+                std::unique_ptr<SandboxSlot> slot = create();
+                if (!slot) break;
+                lock.lock();
+                idle_.push_back(std::move(slot));
+                lock.unlock();
+            }
+            lock.lock();
+        }
+        idle_.clear();
+    }
+
+    size_t min_ = 0;
+    size_t max_ = 0;
+    size_t target_ = 0;
+
+    std::mutex m_;
+    std::condition_variable cv_;
+    std::deque<std::unique_ptr<SandboxSlot>> idle_;
+    size_t acquisitions_ = 0;
+    size_t misses_ = 0;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+static SandboxPool g_sandboxes;
+
+// Runs a user program under the sandbox limits, in a pre-warmed slot when
+// one is ready and through a fresh spawn (in `fallback_cwd`) otherwise.
+// Programs run from a slot have the slot's own scratch directory as cwd.
+static ProcResult run_sandboxed(const std::vector<std::string>& args,
+                                const std::string& input,
+                                const std::string& fallback_cwd = "")
+{
+    std::unique_ptr<SandboxSlot> slot = g_sandboxes.acquire();
+    if (!slot)
+        return run_process_capture(args, input, RUN_TIMEOUT_MS, true, fallback_cwd);
+
+    std::string command;
+    for (const auto& a : args) {
+        command += a;
+        command.push_back('\0');
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    // Fits in PIPE_BUF, so this either goes through whole or the sandbox
+    // is gone (EPIPE).
+    bool sent = command.size() <= PIPE_BUF &&
+                write(slot->control_fd, command.data(), command.size()) == (ssize_t)command.size();
+    close(slot->control_fd);
+    slot->control_fd = -1;
+    if (!sent)
+        return run_process_capture(args, input, RUN_TIMEOUT_MS, true, fallback_cwd);
+
+    // From here on the supervisor owns the process (it reaps it) and the
+    // stdio pipes (it closes them when done).
+    pid_t pid = slot->pid;
+    int in_fd = slot->stdin_fd, out_fd = slot->stdout_fd, err_fd = slot->stderr_fd;
+    slot->pid = -1;
+    slot->stdin_fd = slot->stdout_fd = slot->stderr_fd = -1;
+    std::function<void()> kill_job;
+    if (slot->cgroup) kill_job = [job = slot->cgroup.get()] { job->kill(); };
+    ProcResult res = g_supervisor.watch(pid, in_fd, input, out_fd, err_fd,
+                                        g_config.output_cap, RUN_TIMEOUT_MS, true, started,
+                                        std::move(kill_job)).get();
+    if (slot->cgroup) slot->cgroup->collect(res);
+    return res;
+}
+
+// ------------------------- Compile cache -------------------------
+
+// Plain SHA-256 (FIPS 180-4). Cache keys must be collision resistant: a
+// crafted collision would hand one user another user's binary.
+static std::string sha256_hex(const std::string& data) {
+    static const uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                     0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+    auto rotr = [](uint32_t x, int n) { return (x >> n) | (x << (32 - n)); };
+
+    std::string msg = data;
+    uint64_t bit_len = (uint64_t)data.size() * 8;
+    msg.push_back((char)0x80);
+    while (msg.size() % 64 != 56) msg.push_back('\0');
+    for (int i = 7; i >= 0; i--) msg.push_back((char)(bit_len >> (i * 8)));
+
+    for (size_t off = 0; off < msg.size(); off += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            const unsigned char* p = (const unsigned char*)msg.data() + off + i * 4;
+            w[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t S1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = hh + S1 + ch + k[i] + w[i];
+            uint32_t S0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = S0 + maj;
+            hh = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+        h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+    }
+
+    static const char* hex = "0123456789abcdef";
+    std::string out;
+    for (uint32_t v : h)
+        for (int i = 28; i >= 0; i -= 4) out.push_back(hex[(v >> i) & 0xf]);
+    return out;
+}
+
+// First line of `g++ --version`, filled in at startup. Part of every cache
+// key so a compiler upgrade never serves binaries built by the old one.
+static std::string g_compiler_version;
+
+static std::string compile_cache_key(const std::string& code, const std::vector<std::string>& flags) {
+    std::string material = g_compiler_version;
+    material.push_back('\0');
+    for (const auto& f : flags) {
+        material += f;
+        material.push_back('\0');
+    }
+    material.push_back('\0');
+    material += code;
+    return sha256_hex(material);
+}
+
+struct CachedBinary {
+    std::string key;
+    std::string path;
+    uint64_t size = 0;
+};
+
+// Content-addressed store of compiled binaries under <dir>/<sha256>, bounded
+// by total size with LRU eviction. The on-disk files are the source of
+// truth: on startup the index is rebuilt from them, ordered by mtime (hits
+// touch the file), so the cache and its recency survive restarts.
+//
+// Lookups return a shared_ptr that pins the binary; pinned entries are never
+// evicted, so a program can't disappear between lookup and exec.
+class CompileCache {
+public:
+    void init(const std::string& dir, uint64_t max_bytes) {
+        namespace fs = std::filesystem;
+        // Absolute, because programs run with their workspace as cwd.
+        dir_ = fs::absolute(dir).string();
+        max_bytes_ = max_bytes;
+        fs::create_directories(dir_);
+
+        std::vector<std::pair<fs::file_time_type, std::shared_ptr<CachedBinary>>> found;
+        std::error_code ec;
+        for (auto& entry : fs::directory_iterator(dir_, ec)) {
+            std::string name = entry.path().filename().string();
+            if (!entry.is_regular_file() || !is_key(name)) {
+                fs::remove_all(entry.path(), ec); // leftovers from interrupted inserts
+                continue;
+            }
+            auto bin = std::make_shared<CachedBinary>();
+            bin->key = name;
+            bin->path = entry.path().string();
+            bin->size = entry.file_size(ec);
+            found.push_back({entry.last_write_time(ec), bin});
+        }
+        std::sort(found.begin(), found.end(),
+                  [](const auto& a, const auto& b) { return a.first > b.first; });
+
+        std::lock_guard<std::mutex> lock(m_);
+        for (auto& f : found) {
+            auto it = lru_.insert(lru_.end(), std::move(f.second));
+            index_[(*it)->key] = it;
+            total_bytes_ += (*it)->size;
+        }
+        evict_locked();
+    }
+
+    std::shared_ptr<const CachedBinary> lookup(const std::string& key) {
+        std::lock_guard<std::mutex> lock(m_);
+        auto it = index_.find(key);
+        if (it == index_.end()) return nullptr;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        touch((*it->second)->path);
+        return *it->second;
+    }
+
+    // Moves a freshly built binary into the store. Returns nullptr if it
+    // could not be stored; the caller then runs its own copy. A key that is
+    // already stored is never written again: a running job may have it
+    // pinned, and its recorded size must keep matching the file.
+    std::shared_ptr<const CachedBinary> insert(const std::string& key, const std::string& built_path) {
+        namespace fs = std::filesystem;
+        if (auto existing = lookup(key)) return existing; // another job built it first
+
+        std::error_code ec;
+        std::string final_path = dir_ + "/" + key;
+        std::string tmp = final_path + ".tmp-" + std::to_string(tmp_id_++);
+
+        // The workspace may be on tmpfs: copy, then publish so readers only
+        // ever see complete files. link() refuses to replace a file a racing
+        // writer published in the meantime; theirs is kept and ours dropped.
+        fs::copy_file(built_path, tmp, fs::copy_options::overwrite_existing, ec);
+        bool published = !ec && link(tmp.c_str(), final_path.c_str()) == 0;
+        bool raced = !ec && !published && errno == EEXIST;
+        fs::remove(tmp, ec);
+        if (!published && !raced) return nullptr;
+
+        auto bin = std::make_shared<CachedBinary>();
+        bin->key = key;
+        bin->path = final_path;
+        bin->size = fs::file_size(final_path, ec);
+        if (ec) return nullptr;
+
+        std::lock_guard<std::mutex> lock(m_);
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            // The racing writer indexed it first; keep the pinned one.
+            lru_.splice(lru_.begin(), lru_, it->second);
+            touch(final_path);
+            return *it->second;
+        }
+        lru_.push_front(bin);
+        index_[key] = lru_.begin();
+        total_bytes_ += bin->size;
+        evict_locked();
+        return bin;
+    }
+
+private:
+    static bool is_key(const std::string& name) {
+        if (name.size() != 64) return false;
+        for (char c : name)
+            if (!std::isxdigit((unsigned char)c) || std::isupper((unsigned char)c)) return false;
+        return true;
+    }
+
+    static void touch(const std::string& path) {
+        utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    }
+
+    void evict_locked() {
+        auto it = lru_.end();
+        while (total_bytes_ > max_bytes_ && it != lru_.begin()) {
+            --it;
+            if (it->use_count() > 1) continue; // pinned by a running job
+            std::error_code ec;
+            std::filesystem::remove((*it)->path, ec);
+            total_bytes_ -= (*it)->size;
+            index_.erase((*it)->key);
+            it = lru_.erase(it);
+        }
+    }
+
+    std::string dir_;
+    uint64_t max_bytes_ = 0;
+    std::atomic<uint64_t> tmp_id_{0};
+
+    std::mutex m_;
+    std::list<std::shared_ptr<CachedBinary>> lru_;   // most recent first
+    std::unordered_map<std::string, std::list<std::shared_ptr<CachedBinary>>::iterator> index_;
+    uint64_t total_bytes_ = 0;
+};
+
+static CompileCache g_compile_cache;
+// Object files of multi-file projects, keyed by TU and header contents.
+static CompileCache g_object_cache;
+
+// ------------------------- Binary handles -------------------------
+
+// Named references to compiled binaries, so one /compile serves any number
+// of /execute calls. A handle pins its cache entry (the shared_ptr keeps
+// CompileCache from evicting it) until it expires; every use pushes the
+// expiry out again. Expired handles are dropped lazily on access.
+class BinaryHandles {
+public:
+    void init(std::chrono::seconds ttl, size_t max_handles) {
+        ttl_ = ttl;
+        max_handles_ = std::max<size_t>(1, max_handles);
+    }
+
+    std::chrono::seconds ttl() const { return ttl_; }
+
+    std::string add(std::shared_ptr<const CachedBinary> binary) {
+        std::string id = random_id();
+        auto now = std::chrono::steady_clock::now();
+
+        std::lock_guard<std::mutex> lock(m_);
+        sweep_locked(now);
+        if (handles_.size() >= max_handles_) {
+            // Full: the handle closest to expiring goes first.
+            auto oldest = std::min_element(handles_.begin(), handles_.end(),
+                [](const auto& a, const auto& b) { return a.second.expires < b.second.expires; });
+            handles_.erase(oldest);
+        }
+        handles_[id] = Entry{std::move(binary), now + ttl_};
+        return id;
+    }
+
+    std::shared_ptr<const CachedBinary> find(const std::string& id) {
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(m_);
+        sweep_locked(now);
+        auto it = handles_.find(id);
+        if (it == handles_.end()) return nullptr;
+        it->second.expires = now + ttl_;
+        return it->second.binary;
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<const CachedBinary> binary;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    // Handles are capabilities: anyone holding one can run the binary, so
+    // they must not be guessable from another user's.
+    static std::string random_id() {
+        unsigned char bytes[16];
+        size_t got = 0;
+        while (got < sizeof(bytes)) {
+            ssize_t n = getrandom(bytes + got, sizeof(bytes) - got, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            got += (size_t)n;
+        }
+        static const char* hex = "0123456789abcdef";
+        std::string id;
+        for (unsigned char b : bytes) {
+            id.push_back(hex[b >> 4]);
+            id.push_back(hex[b & 0xf]);
+        }
+        return id;
+    }
+
+    void sweep_locked(std::chrono::steady_clock::time_point now) {
+        for (auto it = handles_.begin(); it != handles_.end();) {
+            if (it->second.expires <= now) it = handles_.erase(it);
+            else ++it;
+        }
+    }
+
+    std::chrono::seconds ttl_{600};
+    size_t max_handles_ = 1024;
+
+    std::mutex m_;
+    std::unordered_map<std::string, Entry> handles_;
+};
+
+static BinaryHandles g_handles;
+
+// ------------------------- Result memoization -------------------------
+
+// Results of earlier runs, keyed by (binary, stdin). A deterministic
+// program run again on the same input prints the same thing, so a repeat
+// can be answered without spawning anything. Requests opt in with
+// "memoize" (and opt out again with "nondeterministic" for programs that
+// read the clock or randomness). Bounded by bytes with LRU eviction;
+// entries also expire after a TTL.
+class ResultCache {
+public:
+    void init(uint64_t max_bytes, std::chrono::seconds ttl) {
+        max_bytes_ = max_bytes;
+        ttl_ = ttl;
+    }
+
+    bool enabled() const { return max_bytes_ > 0; }
+
+    static std::string key(const std::string& binary_key, const std::string& input) {
+        return sha256_hex(binary_key + '\0' + input);
+    }
+
+    std::optional<ProcResult> find(const std::string& key) {
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(m_);
+        auto it = index_.find(key);
+        if (it == index_.end()) return std::nullopt;
+        if (it->second->expires <= now) {
+            erase_locked(it->second);
+            return std::nullopt;
+        }
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return it->second->result;
+    }
+
+    void store(const std::string& key, const ProcResult& result) {
+        // Only finished runs: limits and timeouts depend on machine load
+        // as much as on the program.
+        if (result.timed_out || result.cpu_limit_exceeded || result.memory_limit_exceeded ||
+            result.exit_code < 0)
+            return;
+        size_t bytes = key.size() + result.output.size() + result.error_output.size() + sizeof(Entry);
+        if (bytes > max_bytes_) return;
+
+        std::lock_guard<std::mutex> lock(m_);
+        auto it = index_.find(key);
+        if (it != index_.end()) erase_locked(it->second);
+        lru_.push_front(Entry{key, result, bytes, std::chrono::steady_clock::now() + ttl_});
+        lru_.front().result.memoized = true;
+        index_[key] = lru_.begin();
+        total_bytes_ += bytes;
+        while (total_bytes_ > max_bytes_) erase_locked(std::prev(lru_.end()));
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        ProcResult result;
+        size_t bytes;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    void erase_locked(std::list<Entry>::iterator it) {
+        total_bytes_ -= it->bytes;
+        index_.erase(it->key);
+        lru_.erase(it);
+    }
+
+    uint64_t max_bytes_ = 0;
+    std::chrono::seconds ttl_{300};
+
+    std::mutex m_;
+    std::list<Entry> lru_;   // most recent first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    uint64_t total_bytes_ = 0;
+};
+
+static ResultCache g_results;
+
+// Runs a binary from the compile cache in a sandbox. With `memoize`, a
+// repeat of the same (binary, input) is answered from g_results. Binaries
+// that aren't in the cache (no key) always run.
+static ProcResult run_binary(const std::shared_ptr<const CachedBinary>& binary,
+                             const std::string& path,
+                             const std::string& input,
+                             const std::string& fallback_cwd,
+                             bool memoize)
+{
+    bool memo = memoize && g_results.enabled() && binary && !binary->key.empty();
+    std::string key;
+    if (memo) {
+        key = ResultCache::key(binary->key, input);
+        if (auto hit = g_results.find(key)) return *hit;
+    }
+    ProcResult run = run_sandboxed({path}, input, fallback_cwd);
+    if (memo) g_results.store(key, run);
+    return run;
+}
+
+// ------------------------- Precompiled headers -------------------------
+
+// Returns the sorted set of headers a submission pulls in with its leading
+// `#include <...>` lines (blank lines and comments allowed in between), or
+// nullopt when anything else (macros, quoted includes) comes first and a
+// precompiled prologue could change the meaning of the program.
+static std::optional<std::vector<std::string>> leading_system_includes(const std::string& code) {
+    std::vector<std::string> headers;
+    std::istringstream in(code);
+    std::string line;
+    bool in_comment = false;
+
+    while (std::getline(in, line)) {
+        std::string t = trim(line);
+        if (in_comment) {
+            auto end = t.find("*/");
+            if (end == std::string::npos) continue;
+            in_comment = false;
+            t = trim(t.substr(end + 2));
+        }
+        if (t.rfind("/*", 0) == 0) {
+            auto end = t.find("*/", 2);
+            if (end == std::string::npos) { in_comment = true; continue; }
+            t = trim(t.substr(end + 2));
+        }
+        if (t.empty() || t.rfind("//", 0) == 0) continue;
+
+        if (t[0] != '#') break;
+        t = trim(t.substr(1));
+        if (t.rfind("include", 0) != 0) return std::nullopt;
+        t = trim(t.substr(7));
+        auto close = t.find('>');
+        if (t.empty() || t[0] != '<' || close == std::string::npos) return std::nullopt;
+        std::string rest = trim(t.substr(close + 1));
+        if (!rest.empty() && rest.rfind("//", 0) != 0) return std::nullopt;
+        headers.push_back(t.substr(1, close - 1));
+    }
+
+    if (headers.empty()) return std::nullopt;
+    std::sort(headers.begin(), headers.end());
+    headers.erase(std::unique(headers.begin(), headers.end()), headers.end());
+    return headers;
+}
+
+// Keeps a precompiled header per configured prologue (a set of standard
+// headers) and compile flag set. A submission whose leading includes are
+// exactly a prologue gets `-include <dir>/prologue.h`; g++ then loads the
+// neighbouring prologue.h.gch, or silently parses prologue.h itself if the
+// .gch does not fit the flags, so a mismatch only costs time.
+//
+// PCHs are built on a background thread at startup. A stamp file records
+// what each .gch was built from so restarts reuse them when nothing changed.
+class PchManager {
+public:
+    ~PchManager() {
+        if (builder_.joinable()) builder_.join();
+    }
+
+    void init(const std::string& dir,
+              const std::vector<std::vector<std::string>>& prologues,
+              const std::vector<std::vector<std::string>>& flag_sets) {
+        namespace fs = std::filesystem;
+        std::string root = fs::absolute(dir).string();
+        fs::create_directories(root);
+
+        std::vector<std::string> live;
+        for (const auto& prologue : prologues) {
+            std::vector<std::string> headers = prologue;
+            std::sort(headers.begin(), headers.end());
+            headers.erase(std::unique(headers.begin(), headers.end()), headers.end());
+            if (headers.empty()) continue;
+
+            for (const auto& flags : flag_sets) {
+                auto e = std::make_unique<Entry>();
+                e->headers = headers;
+                e->flags = flags;
+                e->stamp = g_compiler_version + "\n";
+                for (const auto& f : flags) e->stamp += f + " ";
+                e->stamp += "\n";
+                for (const auto& h : headers) e->stamp += h + " ";
+                e->dir = root + "/" + sha256_hex(e->stamp).substr(0, 16);
+                live.push_back(e->dir);
+                entries_.push_back(std::move(e));
+            }
+        }
+
+        // Drop PCHs for prologues, flags or compilers we no longer use.
+        std::error_code ec;
+        for (auto& entry : fs::directory_iterator(root, ec)) {
+            if (std::find(live.begin(), live.end(), entry.path().string()) == live.end())
+                fs::remove_all(entry.path(), ec);
+        }
+
+        builder_ = std::thread([this] { build_all(); });
+    }
+
+    // Path to pass to `-include`, or "" when no ready PCH fits this source.
+    std::string match(const std::string& code, const std::vector<std::string>& flags) const {
+        if (entries_.empty()) return "";
+        auto headers = leading_system_includes(code);
+        if (!headers) return "";
+        for (const auto& e : entries_) {
+            if (e->ready.load() && e->flags == flags && e->headers == *headers)
+                return e->dir + "/prologue.h";
+        }
+        return "";
+    }
+
+private:
+    struct Entry {
+        std::vector<std::string> headers;
+        std::vector<std::string> flags;
+        std::string stamp;
+        std::string dir;
+        std::atomic<bool> ready{false};
+    };
+
+    void build_all() {
+        namespace fs = std::filesystem;
+        for (auto& e : entries_) {
+            std::error_code ec;
+            if (read_file(e->dir + "/stamp") == e->stamp && fs::exists(e->dir + "/prologue.h.gch", ec)) {
+                e->ready = true;
+                continue;
+            }
+
+            fs::create_directories(e->dir, ec);
+            fs::remove(e->dir + "/stamp", ec);
+            {
+                std::ofstream out(e->dir + "/prologue.h");
+                for (const auto& h : e->headers) out << "#include <" << h << ">\n";
+            }
+
+            std::vector<std::string> args = {"g++"};
+            args.insert(args.end(), e->flags.begin(), e->flags.end());
+            args.insert(args.end(), {"-x", "c++-header", "prologue.h", "-o", "prologue.h.gch.tmp"});
+            ProcResult r = run_process_capture(args, "", 120000, false, e->dir);
+            if (r.exit_code != 0) {
+                std::cerr << "PCH build failed in " << e->dir << ":\n" << r.output << r.error_output;
+                continue;
+            }
+            fs::rename(e->dir + "/prologue.h.gch.tmp", e->dir + "/prologue.h.gch", ec);
+            if (ec) continue;
+
+            std::ofstream(e->dir + "/stamp") << e->stamp;
+            e->ready = true;
+        }
+    }
+
+    std::vector<std::unique_ptr<Entry>> entries_;
+    std::thread builder_;
+};
+
+static PchManager g_pch;
+
+// Compiler settings a request can pick with "profile". The flags are part
+// of the cache key and of each PCH, so profiles never share binaries.
+struct CompileProfile {
+    std::string name;
+    std::vector<std::string> flags;
+    int timeout_ms;   // LTO and -O3 legitimately take longer
+};
+
+static const std::vector<CompileProfile> COMPILE_PROFILES = {
+    {"fast",    {"-std=c++17", "-O0", "-g0"}, 5000},               // quickest edit/run loop
+    {"default", {"-std=c++17", "-O2"}, 5000},
+    {"max",     {"-std=c++17", "-O3", "-march=native", "-flto"}, 15000},
+};
+
+static const CompileProfile* find_profile(const std::string& name) {
+    for (const auto& p : COMPILE_PROFILES)
+        if (p.name == name) return &p;
+    return nullptr;
+}
+
+static std::string usage_json(const ResourceUsage& u) {
+    auto num = [](double v) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.3f", v);
+        return std::string(buf);
+    };
+    std::string json = "{";
+    json += "\"user_ms\":" + num(u.user_ms) + ",";
+    json += "\"sys_ms\":" + num(u.sys_ms) + ",";
+    json += "\"wall_ms\":" + num(u.wall_ms) + ",";
+    json += "\"max_rss_kb\":" + std::to_string(u.max_rss_kb) + ",";
+    json += "\"minor_faults\":" + std::to_string(u.minor_faults) + ",";
+    json += "\"major_faults\":" + std::to_string(u.major_faults) + ",";
+    json += "\"voluntary_switches\":" + std::to_string(u.voluntary_switches) + ",";
+    json += "\"involuntary_switches\":" + std::to_string(u.involuntary_switches);
+    if (u.cgroup_memory_peak_kb >= 0)
+        json += ",\"cgroup_memory_peak_kb\":" + std::to_string(u.cgroup_memory_peak_kb);
+    if (u.cgroup_cpu_ms >= 0)
+        json += ",\"cgroup_cpu_ms\":" + num(u.cgroup_cpu_ms);
+    json += "}";
+    return json;
+}
+
+// The part of a /run or /run-nan response that describes the program run.
+static std::string run_result_fields(const ProcResult& run) {
+    std::string json;
+    json += "\"exit_code\":" + std::to_string(run.exit_code) + ",";
+    json += "\"timed_out\":" + std::string(run.timed_out ? "true" : "false") + ",";
+    json += "\"cpu_limit_exceeded\":" + std::string(run.cpu_limit_exceeded ? "true" : "false") + ",";
+    json += "\"memory_limit_exceeded\":" + std::string(run.memory_limit_exceeded ? "true" : "false") + ",";
+    json += "\"usage\":" + usage_json(run.usage) + ",";
+    json += "\"truncated\":" + std::string(run.truncated ? "true" : "false") + ",";
+    json += "\"memoized\":" + std::string(run.memoized ? "true" : "false") + ",";
+    json += "\"output\":\"" + json_escape(run.output) + "\",";
+    json += "\"stderr\":\"" + json_escape(run.error_output) + "\"";
+    return json;
+}
+
+// Result of getting `code` built: either a binary (from the cache or
+// freshly compiled) or the compiler's complaint.
+struct CompileOutcome {
+    bool ok = false;
+    bool cache_hit = false;
+    bool coalesced = false;                      // shared another request's compile
+    const CompileProfile* profile = nullptr;
+    std::shared_ptr<const CachedBinary> cached;  // null if the store refused it
+    std::string binary_path;
+    std::string compile_usage = "null";
+    std::string error_json;                      // full response body when !ok
+};
+
+// Runs g++ on `code` inside `ws` and stores the result in the cache.
+static CompileOutcome build_in_workspace(const std::string& code, const std::string& key,
+                                         const CompileProfile& profile, const Workspace& ws)
+{
+    const std::vector<std::string>& flags = profile.flags;
+    CompileOutcome out;
+    out.profile = &profile;
+
+    // 1️⃣ Write source file
+    {
+        std::ofstream src(ws.path("main.cpp"));
+        if (!src) {
+            out.error_json = R"({"ok":false,"error":"Failed to write source file"})";
+            return out;
+        }
+        src << code;
+    }
+
+    // 2️⃣ Compile
+    std::vector<std::string> args = {"g++", "main.cpp"};
+    args.insert(args.end(), flags.begin(), flags.end());
+    std::string pch = g_pch.match(code, flags);
+    if (!pch.empty()) args.insert(args.end(), {"-include", pch});
+    args.insert(args.end(), {"-o", "prog"});
+    ProcResult compile = run_process_capture(args, "", profile.timeout_ms, false, ws.dir);
+
+    out.compile_usage = usage_json(compile.usage);
+    if (compile.exit_code != 0) {
+        out.error_json = std::string("{\"ok\":false,\"stage\":\"compile\",\"output\":\"")
+            + json_escape(compile.output + compile.error_output) + "\","
+            + "\"compile_usage\":" + out.compile_usage + "}";
+        return out;
+    }
+
+    out.cached = g_compile_cache.insert(key, ws.path("prog"));
+    out.binary_path = out.cached ? out.cached->path : ws.path("prog");
+    out.ok = true;
+    return out;
+}
+
+// Single-flight for compiles: while one request is building a cache key,
+// others asking for the same key wait for its outcome instead of starting
+// their own g++. A class pressing Run on the starter code at once costs one
+// compile, not thirty.
+class CompileFlights {
+public:
+    // Returns the outcome of the in-flight compile of `key`, or nullopt
+    // after registering the caller as its leader (who must call finish()).
+    std::optional<std::shared_future<CompileOutcome>> join(const std::string& key) {
+        std::lock_guard<std::mutex> lock(m_);
+        auto it = flights_.find(key);
+        if (it != flights_.end()) return it->second.future;
+        Flight& f = flights_[key];
+        f.future = f.promise.get_future().share();
+        return std::nullopt;
+    }
+
+    void finish(const std::string& key, const CompileOutcome& outcome) {
+        std::lock_guard<std::mutex> lock(m_);
+        auto it = flights_.find(key);
+        it->second.promise.set_value(outcome);
+        flights_.erase(it);
+    }
+
+    void fail(const std::string& key, std::exception_ptr error) {
+        std::lock_guard<std::mutex> lock(m_);
+        auto it = flights_.find(key);
+        it->second.promise.set_exception(error);
+        flights_.erase(it);
+    }
+
+private:
+    struct Flight {
+        std::promise<CompileOutcome> promise;
+        std::shared_future<CompileOutcome> future;
+    };
+
+    std::mutex m_;
+    std::unordered_map<std::string, Flight> flights_;
+};
+
+static CompileFlights g_compile_flights;
+
+static CompileOutcome compile_code(const std::string& code, const CompileProfile& profile,
+                                   const Workspace& ws)
+{
+    std::string key = compile_cache_key(code, profile.flags);
+
+    auto from_cache = [&profile](std::shared_ptr<const CachedBinary> bin) {
+        CompileOutcome out;
+        out.ok = true;
+        out.profile = &profile;
+        out.cache_hit = true;
+        out.binary_path = bin->path;
+        out.cached = std::move(bin);
+        return out;
+    };
+
+    if (auto bin = g_compile_cache.lookup(key)) return from_cache(std::move(bin));
+
+    if (auto flight = g_compile_flights.join(key)) {
+        CompileOutcome out = flight->get();
+        out.coalesced = true;
+        // The leader's own copy lives in its workspace, which is gone by
+        // now; only a stored binary can be shared.
+        if (out.ok && !out.cached) return build_in_workspace(code, key, profile, ws);
+        return out;
+    }
+
+    CompileOutcome out;
+    try {
+        // The previous leader may have finished between our lookup and join.
+        if (auto bin = g_compile_cache.lookup(key)) out = from_cache(std::move(bin));
+        else out = build_in_workspace(code, key, profile, ws);
+    } catch (...) {
+        g_compile_flights.fail(key, std::current_exception());
+        throw;
+    }
+    g_compile_flights.finish(key, out);
+    return out;
+}
+
+// profile, cache_hit, coalesced and compile_usage for responses that
+// compiled code.
+static std::string compile_fields(const CompileOutcome& built) {
+    std::string json;
+    json += "\"profile\":\"" + built.profile->name + "\",";
+    json += "\"cache_hit\":" + std::string(built.cache_hit ? "true" : "false") + ",";
+    json += "\"coalesced\":" + std::string(built.coalesced ? "true" : "false") + ",";
+    json += "\"compile_usage\":" + built.compile_usage;
+    return json;
+}
+
+static std::string handle_run_cpp(const std::string& code,
+                                  const std::string& input,
+                                  const CompileProfile& profile,
+                                  bool memoize)
+{
+    Workspace ws;
+
+    CompileOutcome built = compile_code(code, profile, ws);
+    if (!built.ok) return built.error_json;
+
+    // 3️⃣ Run
+    ProcResult run = run_binary(built.cached, built.binary_path, input, ws.dir, memoize);
+
+    std::string json = "{";
+    json += "\"ok\":true,";
+    json += compile_fields(built) + ",";
+    json += run_result_fields(run);
+    json += "}";
+
+    return json;
+}
+
+#ifndef MFD_EXEC
+#define MFD_EXEC 0x0010U
+#endif
+
+// An anonymous, executable in-memory file. MFD_EXEC keeps it runnable on
+// kernels with vm.memfd_noexec set; older kernels reject the flag.
+static int create_exec_memfd(const char* name) {
+    int fd = memfd_create(name, MFD_CLOEXEC | MFD_EXEC);
+    if (fd < 0 && errno == EINVAL) fd = memfd_create(name, MFD_CLOEXEC);
+    return fd;
+}
+
+// /run without the filesystem: the source reaches g++ over stdin, the
+// linker writes the binary into a memfd (as /proc/self/fd/3), and the
+// program is started from that fd with fexecve. The compile cache and
+// user_codes are bypassed entirely; the only files are the assembler's
+// temporary object and the program's cwd, both under the workspace root
+// (tmpfs when one is usable).
+static std::string handle_run_cpp_in_memory(const std::string& code,
+                                            const std::string& input,
+                                            const CompileProfile& profile)
+{
+    int image = create_exec_memfd("prog");
+    if (image < 0)
+        return R"({"ok":false,"error":"memfd_create failed"})";
+
+    const std::vector<std::string>& flags = profile.flags;
+    SpawnRequest compile;
+    compile.args = {"g++", "-x", "c++", "-", "-pipe"};
+    compile.args.insert(compile.args.end(), flags.begin(), flags.end());
+    std::string pch = g_pch.match(code, flags);
+    if (!pch.empty()) compile.args.insert(compile.args.end(), {"-include", pch});
+    compile.args.insert(compile.args.end(), {"-o", "/proc/self/fd/3"});
+    compile.cwd = g_workspaces.root();
+    compile.env = {"TMPDIR=" + g_workspaces.root()};
+    compile.inherit_fd = image;
+    ProcResult compiled = run_process_capture(std::move(compile), code, profile.timeout_ms);
+
+    CompileOutcome built;
+    built.profile = &profile;
+    built.compile_usage = usage_json(compiled.usage);
+    if (compiled.exit_code != 0) {
+        close(image);
+        return std::string("{\"ok\":false,\"stage\":\"compile\",\"output\":\"")
+            + json_escape(compiled.output + compiled.error_output) + "\","
+            + "\"compile_usage\":" + built.compile_usage + "}";
+    }
+
+    // exec refuses (ETXTBSY) a file that is still open for writing, so
+    // run it through a read-only descriptor.
+    int program = open(("/proc/self/fd/" + std::to_string(image)).c_str(), O_RDONLY | O_CLOEXEC);
+    close(image);
+    if (program < 0)
+        return R"({"ok":false,"error":"Failed to reopen the compiled binary"})";
+
+    Workspace ws;
+    SpawnRequest spawn;
+    spawn.args = {"prog"};
+    spawn.cwd = ws.dir;
+    spawn.limit_resources = true;
+    spawn.exec_fd = program;
+    ProcResult run = run_process_capture(std::move(spawn), input, RUN_TIMEOUT_MS);
+    close(program);
+
+    std::string json = "{";
+    json += "\"ok\":true,";
+    json += "\"in_memory\":true,";
+    json += compile_fields(built) + ",";
+    json += run_result_fields(run);
+    json += "}";
+
+    return json;
+}
+
+// Two-pass profile-guided build for /run with "pgo": the program is built
+// with -fprofile-generate and run on the request's input, then rebuilt
+// with -fprofile-use from the counters that run left behind, and run
+// again. Both passes are reported. The binary is specific to this input,
+// so neither pass goes through the compile cache.
+static std::string handle_run_cpp_pgo(const std::string& code,
+                                      const std::string& input,
+                                      const CompileProfile& profile)
+{
+    Workspace ws;
+    {
+        std::ofstream src(ws.path("main.cpp"));
+        if (!src) {
+            return R"({"ok":false,"error":"Failed to write source file"})";
+        }
+        src << code;
+    }
+
+    // Same source and output names in both passes: GCC names the .gcda
+    // files after them, and -fprofile-use looks for the same names.
+    std::string profile_dir = ws.path("pgo");
+    auto build = [&](const std::string& pgo_flag, std::string& usage, std::string& error) {
+        std::vector<std::string> args = {"g++", "main.cpp"};
+        args.insert(args.end(), profile.flags.begin(), profile.flags.end());
+        args.insert(args.end(), {pgo_flag + "=" + profile_dir, "-o", "prog"});
+        ProcResult compile = run_process_capture(args, "", profile.timeout_ms, false, ws.dir);
+        usage = usage_json(compile.usage);
+        if (compile.exit_code == 0) return true;
+        error = std::string("{\"ok\":false,\"stage\":\"compile\",\"output\":\"")
+              + json_escape(compile.output + compile.error_output) + "\","
+              + "\"compile_usage\":" + usage + "}";
+        return false;
+    };
+
+    std::string instrumented_usage, final_usage, error;
+    if (!build("-fprofile-generate", instrumented_usage, error)) return error;
+
+    // The counters are written at exit, into profile_dir (absolute, so it
+    // works from a pre-warmed sandbox's own cwd too).
+    ProcResult instrumented = run_sandboxed({ws.path("prog")}, input, ws.dir);
+
+    std::string json = "{";
+    json += "\"ok\":true,";
+    json += "\"pgo\":true,";
+    json += "\"profile\":\"" + profile.name + "\",";
+    json += "\"instrumented\":{\"compile_usage\":" + instrumented_usage + ","
+          + run_result_fields(instrumented) + "},";
+
+    // A crashed or killed training run leaves no (or partial) counters;
+    // optimizing for that would be misleading, so stop here.
+    std::error_code ec;
+    bool trained = instrumented.exit_code == 0 && !instrumented.timed_out &&
+                   std::filesystem::exists(profile_dir, ec) && !std::filesystem::is_empty(profile_dir, ec);
+    if (!trained) {
+        json += "\"pgo_error\":\"The instrumented run did not finish cleanly; no profile to optimize with.\"";
+        json += "}";
+        return json;
+    }
+
+    if (!build("-fprofile-use", final_usage, error)) return error;
+    ProcResult run = run_sandboxed({ws.path("prog")}, input, ws.dir);
+
+    json += "\"compile_usage\":" + final_usage + ",";
+    json += run_result_fields(run);
+    json += "}";
+    return json;
+}
+
+// Compiles (or finds in the cache) and returns a handle for /execute.
+static std::string handle_compile(const std::string& code, const CompileProfile& profile)
+{
+    Workspace ws;
+
+    CompileOutcome built = compile_code(code, profile, ws);
+    if (!built.ok) return built.error_json;
+    // A handle has to outlive this workspace, so it needs the stored copy.
+    if (!built.cached)
+        return R"({"ok":false,"error":"Failed to store the compiled binary"})";
+
+    std::string json = "{";
+    json += "\"ok\":true,";
+    json += "\"handle\":\"" + g_handles.add(built.cached) + "\",";
+    json += "\"ttl_seconds\":" + std::to_string(g_handles.ttl().count()) + ",";
+    json += compile_fields(built);
+    json += "}";
+    return json;
+}
+
+// `binary` was resolved from a handle by the router and stays pinned for
+// the duration of the run.
+static std::string handle_execute(const std::shared_ptr<const CachedBinary>& binary,
+                                  const std::string& input,
+                                  bool memoize)
+{
+    Workspace ws;
+
+    ProcResult run = run_binary(binary, binary->path, input, ws.dir, memoize);
+
+    std::string json = "{";
+    json += "\"ok\":true,";
+    json += run_result_fields(run);
+    json += "}";
+    return json;
+}
+
+// Runs fn(0) .. fn(n-1), spread over the worker pool when called from a
+// worker; returns once all of them have finished. Defined with the
+// Scheduler below.
+static void parallel_for(size_t n, const std::function<void(size_t)>& fn);
+
+struct BatchCase {
+    std::string input;
+    std::optional<std::string> expected_output;
+};
+
+// Judge-style comparison: trailing whitespace on each line and trailing
+// blank lines don't matter.
+static std::string normalize_output(const std::string& s) {
+    std::string out;
+    std::istringstream in(s);
+    for (std::string line; std::getline(in, line);) {
+        size_t end = line.find_last_not_of(" \t\r");
+        out += end == std::string::npos ? "" : line.substr(0, end + 1);
+        out.push_back('\n');
+    }
+    while (!out.empty() && out.back() == '\n') out.pop_back();
+    return out;
+}
+
+static const char* batch_verdict(const ProcResult& run, const BatchCase& c) {
+    if (run.timed_out || run.cpu_limit_exceeded) return "time_limit_exceeded";
+    if (run.memory_limit_exceeded) return "memory_limit_exceeded";
+    if (run.exit_code != 0) return "runtime_error";
+    if (!c.expected_output) return "accepted";
+    if (run.truncated) return "output_limit_exceeded";
+    return normalize_output(run.output) == normalize_output(*c.expected_output)
+         ? "accepted" : "wrong_answer";
+}
+
+// Compiles once, then runs every case in its own sandbox, in parallel.
+// With `stop_on_failure`, cases that haven't started when one fails are
+// reported as skipped.
+static std::string handle_run_batch(const std::string& code,
+                                    const std::vector<BatchCase>& cases,
+                                    bool stop_on_failure,
+                                    const CompileProfile& profile,
+                                    bool memoize)
+{
+    Workspace ws;
+
+    CompileOutcome built = compile_code(code, profile, ws);
+    if (!built.ok) return built.error_json;
+
+    struct CaseResult {
+        const char* verdict = "skipped";
+        std::string fields;   // run_result_fields, empty when skipped
+    };
+    std::vector<CaseResult> results(cases.size());
+    std::atomic<bool> failed{false};
+
+    auto started = std::chrono::steady_clock::now();
+    parallel_for(cases.size(), [&](size_t i) {
+        if (stop_on_failure && failed.load()) return;
+
+        Workspace case_ws;   // cwd when no pre-warmed sandbox is free
+        ProcResult run = run_binary(built.cached, built.binary_path, cases[i].input, case_ws.dir, memoize);
+        results[i].verdict = batch_verdict(run, cases[i]);
+        results[i].fields = run_result_fields(run);
+        if (strcmp(results[i].verdict, "accepted") != 0) failed = true;
+    });
+    double wall_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - started).count();
+
+    size_t passed = 0, skipped = 0;
+    std::string list;
+    for (size_t i = 0; i < results.size(); i++) {
+        const CaseResult& r = results[i];
+        if (strcmp(r.verdict, "accepted") == 0) passed++;
+        if (r.fields.empty()) skipped++;
+        if (i) list += ",";
+        list += "{\"index\":" + std::to_string(i) + ",";
+        list += "\"verdict\":\"" + std::string(r.verdict) + "\"";
+        if (!r.fields.empty()) list += "," + r.fields;
+        list += "}";
+    }
+
+    char wall[32];
+    snprintf(wall, sizeof(wall), "%.3f", wall_ms);
+
+    std::string json = "{";
+    json += "\"ok\":true,";
+    json += compile_fields(built) + ",";
+    json += "\"summary\":{\"total\":" + std::to_string(results.size())
+          + ",\"passed\":" + std::to_string(passed)
+          + ",\"failed\":" + std::to_string(results.size() - passed - skipped)
+          + ",\"skipped\":" + std::to_string(skipped)
+          + ",\"wall_ms\":" + wall + "},";
+    json += "\"cases\":[" + list + "]";
+    json += "}";
+    return json;
+}
+
+// ------------------------- Multi-file projects -------------------------
+
+// Header dependencies of a translation unit, as reported by -MMD the last
+// time it was compiled. Keyed by the TU's identity (compiler, flags, name
+// and contents); lets a rebuild compute the object's cache key, which also
+// covers every header the TU includes, without running the compiler.
+// Kept in memory only: after a restart each TU is compiled once to learn
+// its dependencies again.
+class DependencyManifests {
+public:
+    std::optional<std::vector<std::string>> find(const std::string& tu_key) {
+        std::lock_guard<std::mutex> lock(m_);
+        auto it = deps_.find(tu_key);
+        if (it == deps_.end()) return std::nullopt;
+        return it->second;
+    }
+
+    void store(const std::string& tu_key, std::vector<std::string> deps) {
+        std::lock_guard<std::mutex> lock(m_);
+        // Entries are small and cheap to relearn; start over instead of
+        // tracking recency.
+        if (deps_.size() >= MAX_ENTRIES) deps_.clear();
+        deps_[tu_key] = std::move(deps);
+    }
+
+private:
+    static constexpr size_t MAX_ENTRIES = 16384;
+
+    std::mutex m_;
+    std::unordered_map<std::string, std::vector<std::string>> deps_;
+};
+
+static DependencyManifests g_dep_manifests;
+
+// Local headers named in a -MMD dependency file ("obj: src dep dep ..."
+// with backslash-continued lines), without the source itself.
+static std::vector<std::string> parse_depfile(const std::string& text) {
+    std::vector<std::string> deps;
+    size_t colon = text.find(':');
+    if (colon == std::string::npos) return deps;
+    std::istringstream in(text.substr(colon + 1));
+    for (std::string tok; in >> tok;)
+        if (tok != "\\") deps.push_back(tok);
+    if (!deps.empty()) deps.erase(deps.begin());
+    return deps;
+}
+
+// Cache key of an object: the TU's identity plus the contents of every
+// header it included. Headers are read from the project files.
+static std::optional<std::string> object_key(const std::string& tu_key,
+                                             const std::vector<std::string>& deps,
+                                             const std::map<std::string, std::string>& files) {
+    std::string material = tu_key;
+    for (const auto& d : deps) {
+        auto it = files.find(d);
+        if (it == files.end()) return std::nullopt;   // header no longer in the project
+        material.push_back('\0');
+        material += d;
+        material.push_back('\0');
+        material += sha256_hex(it->second);
+    }
+    return sha256_hex(material);
+}
+
+// Builds and runs a project of several sources. Every .cpp compiles to an
+// object in parallel (one compiler per worker); an object whose source and
+// headers are unchanged comes straight from the object cache, so editing
+// one file recompiles only the TUs that see it before relinking. The link
+// is cached too, keyed by its objects.
+static std::string handle_run_project(const std::map<std::string, std::string>& files,
+                                      const std::string& input,
+                                      const CompileProfile& profile,
+                                      bool memoize)
+{
+    Workspace ws;
+    for (const auto& [name, content] : files) {
+        std::ofstream out(ws.path(name), std::ios::binary);
+        if (!out) return R"({"ok":false,"error":"Failed to write source file"})";
+        out << content;
+    }
+
+    struct Unit {
+        std::string name;
+        std::shared_ptr<const CachedBinary> object;
+        bool reused = false;
+        std::string errors;
+    };
+    std::vector<Unit> units;
+    for (const auto& f : files)
+        if (f.first.size() > 4 && f.first.compare(f.first.size() - 4, 4, ".cpp") == 0)
+            units.push_back(Unit{f.first, nullptr, false, ""});
+    if (units.empty()) return R"({"ok":false,"error":"The project has no .cpp files"})";
+
+    auto started = std::chrono::steady_clock::now();
+    parallel_for(units.size(), [&](size_t i) {
+        Unit& u = units[i];
+        std::string tu_key = compile_cache_key(u.name + '\0' + files.at(u.name), profile.flags);
+
+        if (auto deps = g_dep_manifests.find(tu_key)) {
+            if (auto key = object_key(tu_key, *deps, files)) {
+                u.object = g_object_cache.lookup(*key);
+                if (u.object) {
+                    u.reused = true;
+                    return;
+                }
+            }
+        }
+
+        std::string obj = u.name.substr(0, u.name.size() - 4) + ".o";
+        std::string depfile = u.name.substr(0, u.name.size() - 4) + ".d";
+        std::vector<std::string> args = {"g++", "-c", u.name};
+        args.insert(args.end(), profile.flags.begin(), profile.flags.end());
+        args.insert(args.end(), {"-MMD", "-MF", depfile, "-o", obj});
+        ProcResult compile = run_process_capture(args, "", profile.timeout_ms, false, ws.dir);
+        if (compile.exit_code != 0) {
+            u.errors = compile.output + compile.error_output;
+            if (compile.timed_out) u.errors += u.name + ": compile timed out\n";
+            return;
+        }
+
+        std::vector<std::string> deps = parse_depfile(read_file(ws.path(depfile)));
+        auto key = object_key(tu_key, deps, files);
+        if (key) {
+            g_dep_manifests.store(tu_key, deps);
+            u.object = g_object_cache.insert(*key, ws.path(obj));
+        }
+        if (!u.object) {
+            // Not cacheable (e.g. it included a header from outside the
+            // project); link the workspace copy.
+            auto local = std::make_shared<CachedBinary>();
+            local->path = ws.path(obj);
+            u.object = local;
+        }
+    });
+
+    std::string errors;
+    size_t compiled = 0, reused = 0;
+    for (const auto& u : units) {
+        errors += u.errors;
+        if (u.reused) reused++;
+        else if (u.object) compiled++;
+    }
+    if (!errors.empty()) {
+        return std::string("{\"ok\":false,\"stage\":\"compile\",\"output\":\"")
+            + json_escape(errors) + "\"}";
+    }
+
+    // Link, unless these exact objects were linked before. Objects that
+    // aren't in the cache have no stable key, so neither does their link.
+    bool cacheable = true;
+    std::string link_material = "link";
+    for (const auto& u : units) {
+        cacheable = cacheable && !u.object->key.empty();
+        link_material += '\0' + u.object->key;
+    }
+    std::string link_key = compile_cache_key(link_material, profile.flags);
+    std::shared_ptr<const CachedBinary> binary = cacheable ? g_compile_cache.lookup(link_key) : nullptr;
+    bool link_cached = binary != nullptr;
+    if (!binary) {
+        std::vector<std::string> args = {"g++"};
+        for (const auto& u : units) args.push_back(u.object->path);
+        args.insert(args.end(), profile.flags.begin(), profile.flags.end());
+        args.insert(args.end(), {"-o", "prog"});
+        ProcResult link = run_process_capture(args, "", profile.timeout_ms, false, ws.dir);
+        if (link.exit_code != 0) {
+            return std::string("{\"ok\":false,\"stage\":\"link\",\"output\":\"")
+                + json_escape(link.output + link.error_output) + "\"}";
+        }
+        if (cacheable) binary = g_compile_cache.insert(link_key, ws.path("prog"));
+    }
+    std::string binary_path = binary ? binary->path : ws.path("prog");
+    double build_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - started).count();
+
+    ProcResult run = run_binary(binary, binary_path, input, ws.dir, memoize);
+
+    char build[32];
+    snprintf(build, sizeof(build), "%.3f", build_ms);
+
+    std::string json = "{";
+    json += "\"ok\":true,";
+    json += "\"profile\":\"" + profile.name + "\",";
+    json += "\"build\":{\"compiled\":" + std::to_string(compiled)
+          + ",\"reused\":" + std::to_string(reused)
+          + ",\"link_cached\":" + (link_cached ? "true" : "false")
+          + ",\"wall_ms\":" + build + "},";
+    json += run_result_fields(run);
+    json += "}";
+    return json;
+}
+
+// nan scripts run on the interpreter from nan/interpreter.h, built into
+// the server, on the worker thread that picked up the job. There is no
+// process to put limits on, so the interpreter's budgets take their place:
+// instructions instead of the run timeout and compile-time memory instead of
+// RLIMIT_AS. Output is kept in the same CappedBuffer as every other run, but
+// the script is stopped once it prints a few times that much, and again once
+// the job's own deadline (counted from `accepted`) has passed.
+static std::string handle_run_nan(const std::string& program,
+                                  std::chrono::steady_clock::time_point accepted)
+{
+    Budget budget;
+    budget.steps = g_config.nan_max_steps;
+    budget.memory = g_config.nan_memory_max;
+    budget.output = NAN_OUTPUT_CAP_MULTIPLE * g_config.output_cap;
+    budget.deadline = accepted + std::chrono::milliseconds(JOB_TIMEOUT_MS);
+
+    ProcResult run;
+    uint64_t steps = 0;
+    bool step_limit = false;
+    bool output_limit = false;
+
+    struct rusage before{}, after{};
+    getrusage(RUSAGE_THREAD, &before);
+    auto started = std::chrono::steady_clock::now();
+
+    CappedBuffer out(g_config.output_cap), err(g_config.output_cap);
+    try {
+        auto interpreter = std::make_unique<Interpreter>(
+            budget,
+            [&out](const char* data, size_t size) { out.append(data, size); },
+            [&err](const char* data, size_t size) { err.append(data, size); });
+        run.exit_code = interpreter->execute(program) ? 0 : 1;
+        steps = interpreter->stepsUsed();
+        step_limit = interpreter->stopReason() == Stop::StepLimit;
+        output_limit = interpreter->stopReason() == Stop::OutputLimit;
+        run.timed_out = interpreter->stopReason() == Stop::TimeLimit;
+        run.memory_limit_exceeded = interpreter->stopReason() == Stop::MemoryLimit;
+    }
+    catch (const std::bad_alloc&) {
+        run.exit_code = 1;
+        run.memory_limit_exceeded = true;
+        static const char oom[] = "Error: out of memory\n";
+        err.append(oom, sizeof(oom) - 1);
+    }
+    run.output = out.str();
+    run.error_output = err.str();
+    run.truncated = out.truncated() || err.truncated();
+
+    run.usage.wall_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - started).count();
+    getrusage(RUSAGE_THREAD, &after);
+    auto ms = [](const timeval& tv) { return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0; };
+    run.usage.user_ms = ms(after.ru_utime) - ms(before.ru_utime);
+    run.usage.sys_ms = ms(after.ru_stime) - ms(before.ru_stime);
+    run.usage.minor_faults = after.ru_minflt - before.ru_minflt;
+    run.usage.major_faults = after.ru_majflt - before.ru_majflt;
+    run.usage.voluntary_switches = after.ru_nvcsw - before.ru_nvcsw;
+    run.usage.involuntary_switches = after.ru_nivcsw - before.ru_nivcsw;
+
+    std::string json = "{";
+    json += "\"ok\":true,";
+    json += "\"steps\":" + std::to_string(steps) + ",";
+    json += "\"step_limit_exceeded\":" + std::string(step_limit ? "true" : "false") + ",";
+    json += "\"output_limit_exceeded\":" + std::string(output_limit ? "true" : "false") + ",";
+    json += run_result_fields(run);
+    json += "}";
+
+    return json;
+}
+
+// ------------------------- Routing -------------------------
+
+// A route either answers right away (static files, load/save) or hands back
+// work that has to run off the event loop because it compiles or runs code.
+struct RouteResult {
+    std::string response;
+    std::function<std::string()> job;
+};
+
+static std::string json_error_response(int status_code,
+                                       const std::string& status_text,
+                                       const std::string& body) {
+    return http_response(status_code, status_text, "application/json; charset=utf-8", body);
+}
+
+// Result memoization is opt-in per request; "nondeterministic" always wins.
+static bool wants_memoization(const json& j) {
+    return j.value("memoize", false) && !j.value("nondeterministic", false);
+}
+
+static RouteResult route_request(const HttpRequest& req) {
+    RouteResult r;
+
+    std::string path, query;
+    split_path_query(req.path, path, query);
+    auto params = parse_query(query);
+
+    // ensure folder exists
+    std::filesystem::create_directories("user_codes");
+
+    if (req.method == "GET" && (path == "/" || path == "/index.html")) {
+        std::string content = read_file("public/index.html");
+        if (content.empty()) {
+            r.response = http_response(404, "Not Found", "text/plain; charset=utf-8",
+                                       "public/index.html not found.\n");
+        } else {
+            r.response = http_response(200, "OK", "text/html; charset=utf-8", content);
+        }
+    }
+    else if (req.method == "POST" && path == "/run") {
+        try {
+            auto j = json::parse(req.body);
+
+            std::string code  = j.value("code", "");
+            std::string input = j.value("input", "");
+            bool in_memory = j.value("in_memory", g_config.in_memory);
+            bool pgo = j.value("pgo", false);
+            bool memoize = wants_memoization(j);
+
+            if (code.empty()) {
+                r.response = json_error_response(400, "Bad Request",
+                    R"({"ok":false,"error":"Missing 'code'"})");
+                return r;
+            }
+            const CompileProfile* profile = find_profile(j.value("profile", "default"));
+            if (!profile) {
+                r.response = json_error_response(400, "Bad Request",
+                    R"({"ok":false,"error":"Unknown profile: use fast, default or max"})");
+                return r;
+            }
+
+            r.job = [code, input, in_memory, pgo, profile, memoize]() {
+                return http_response(200, "OK", "application/json; charset=utf-8",
+                                     pgo       ? handle_run_cpp_pgo(code, input, *profile)
+                                   : in_memory ? handle_run_cpp_in_memory(code, input, *profile)
+                                               : handle_run_cpp(code, input, *profile, memoize));
+            };
+        }
+        catch (const std::exception& e) {
+            r.response = json_error_response(400, "Bad Request",
+                std::string("{\"ok\":false,\"error\":\"Invalid JSON: ") + json_escape(e.what()) + "\"}");
+        }
+    }
+    else if (req.method == "POST" && path == "/run-batch") {
+        try {
+            auto j = json::parse(req.body);
+
+            std::string code = j.value("code", "");
+            bool stop_on_failure = j.value("stop_on_failure", false);
+            bool memoize = wants_memoization(j);
+
+            if (code.empty()) {
+                r.response = json_error_response(400, "Bad Request",
+                    R"({"ok":false,"error":"Missing 'code'"})");
+                return r;
+            }
+            const CompileProfile* profile = find_profile(j.value("profile", "default"));
+            if (!profile) {
+                r.response = json_error_response(400, "Bad Request",
+                    R"({"ok":false,"error":"Unknown profile: use fast, default or max"})");
+                return r;
+            }
+            if (!j.contains("cases") || !j["cases"].is_array() || j["cases"].empty()) {
+                r.response = json_error_response(400, "Bad Request",
+                    R"({"ok":false,"error":"'cases' must be a non-empty array"})");
+                return r;
+            }
+            if (j["cases"].size() > g_config.batch_max_cases) {
+                r.response = json_error_response(400, "Bad Request",
+                    "{\"ok\":false,\"error\":\"Too many cases (max " +
+                    std::to_string(g_config.batch_max_cases) + ")\"}");
+                return r;
+            }
+
+            std::vector<BatchCase> cases;
+            for (const auto& c : j["cases"]) {
+                BatchCase bc;
+                bc.input = c.value("input", "");
+                if (c.contains("expected_output"))
+                    bc.expected_output = c["expected_output"].get<std::string>();
+                cases.push_back(std::move(bc));
+            }
+
+            r.job = [code, cases = std::move(cases), stop_on_failure, profile, memoize]() {
+                return http_response(200, "OK", "application/json; charset=utf-8",
+                                     handle_run_batch(code, cases, stop_on_failure, *profile, memoize));
+            };
+        }
+        catch (const std::exception& e) {
+            r.response = json_error_response(400, "Bad Request",
+                std::string("{\"ok\":false,\"error\":\"Invalid JSON: ") + json_escape(e.what()) + "\"}");
+        }
+    }
+    else if (req.method == "POST" && path == "/run-project") {
+        try {
+            auto j = json::parse(req.body);
+
+            std::string input = j.value("input", "");
+            bool memoize = wants_memoization(j);
+            const CompileProfile* profile = find_profile(j.value("profile", "default"));
+            if (!profile) {
+                r.response = json_error_response(400, "Bad Request",
+                    R"({"ok":false,"error":"Unknown profile: use fast, default or max"})");
+                return r;
+            }
+
+            // "files": {"name": "source", ...}, or ["name", ...] to build
+            // files previously saved under user_codes/.
+            std::map<std::string, std::string> files;
+            std::string bad_name;
+            if (j.contains("files") && j["files"].is_object()) {
+                for (auto& [name, content] : j["files"].items()) {
+                    if (!sanitize_source_filename(name)) bad_name = name;
+                    else files[name] = content.get<std::string>();
+                }
+            } else if (j.contains("files") && j["files"].is_array()) {
+                for (const auto& n : j["files"]) {
+                    std::string name = n.get<std::string>();
+                    std::string full = "user_codes/" + name;
+                    if (!sanitize_source_filename(name) || !std::filesystem::exists(full)) bad_name = name;
+                    else files[name] = read_file(full);
+                }
+            }
+
+            if (!bad_name.empty()) {
+                r.response = json_error_response(400, "Bad Request",
+                    "{\"ok\":false,\"error\":\"Invalid or missing file: " + json_escape(bad_name) + "\"}");
+                return r;
+            }
+            if (files.empty() || files.size() > g_config.project_max_files) {
+                r.response = json_error_response(400, "Bad Request",
+                    "{\"ok\":false,\"error\":\"'files' must name 1 to " +
+                    std::to_string(g_config.project_max_files) + " sources\"}");
+                return r;
+            }
+
+            r.job = [files = std::move(files), input, profile, memoize]() {
+                return http_response(200, "OK", "application/json; charset=utf-8",
+                                     handle_run_project(files, input, *profile, memoize));
+            };
+        }
+        catch (const std::exception& e) {
+            r.response = json_error_response(400, "Bad Request",
+                std::string("{\"ok\":false,\"error\":\"Invalid JSON: ") + json_escape(e.what()) + "\"}");
+        }
+    }
+    else if (req.method == "POST" && path == "/compile") {
+        try {
+            auto j = json::parse(req.body);
+
+            std::string code = j.value("code", "");
+
+            if (code.empty()) {
+                r.response = json_error_response(400, "Bad Request",
+                    R"({"ok":false,"error":"Missing 'code'"})");
+                return r;
+            }
+            const CompileProfile* profile = find_profile(j.value("profile", "default"));
+            if (!profile) {
+                r.response = json_error_response(400, "Bad Request",
+                    R"({"ok":false,"error":"Unknown profile: use fast, default or max"})");
+                return r;
+            }
+
+            r.job = [code, profile]() {
+                return http_response(200, "OK", "application/json; charset=utf-8",
+                                     handle_compile(code, *profile));
+            };
+        }
+        catch (const std::exception& e) {
+            r.response = json_error_response(400, "Bad Request",
+                std::string("{\"ok\":false,\"error\":\"Invalid JSON: ") + json_escape(e.what()) + "\"}");
+        }
+    }
+    else if (req.method == "POST" && path == "/execute") {
+        try {
+            auto j = json::parse(req.body);
+
+            std::string handle = j.value("handle", "");
+            std::string input  = j.value("input", "");
+            bool memoize = wants_memoization(j);
+
+            if (handle.empty()) {
+                r.response = json_error_response(400, "Bad Request",
+                    R"({"ok":false,"error":"Missing 'handle'"})");
+                return r;
+            }
+
+            std::shared_ptr<const CachedBinary> binary = g_handles.find(handle);
+            if (!binary) {
+                r.response = json_error_response(404, "Not Found",
+                    R"({"ok":false,"error":"Unknown or expired handle"})");
+                return r;
+            }
+
+            r.job = [binary, input, memoize]() {
+                return http_response(200, "OK", "application/json; charset=utf-8",
+                                     handle_execute(binary, input, memoize));
+            };
+        }
+        catch (const std::exception& e) {
+            r.response = json_error_response(400, "Bad Request",
+                std::string("{\"ok\":false,\"error\":\"Invalid JSON: ") + json_escape(e.what()) + "\"}");
+        }
+    }
+    else if (req.method == "GET" && path == "/load") {
+        std::string name = params.count("name") ? params["name"] : "star_code.cpp";
+        auto safe = sanitize_source_filename(name);
+        if (!safe) {
+            r.response = http_response(400, "Bad Request", "text/plain; charset=utf-8",
+                                       "Invalid filename. Use something like star_code.cpp or util.h\n");
+        } else {
+            std::string full = "user_codes/" + *safe;
+            std::string content = read_file(full);
+            if (content.empty() && !std::filesystem::exists(full)) {
+                r.response = http_response(404, "Not Found", "text/plain; charset=utf-8",
+                                           ("File not found: " + full + "\n"));
+            } else {
+                r.response = http_response(200, "OK", "text/plain; charset=utf-8", content);
+            }
+        }
+    }
+    else if (req.method == "POST" && path == "/run-nan") {
+        try {
+            auto j = json::parse(req.body);
+
+            std::string program = j.value("program", "");
+
+            if (program.empty()) {
+                r.response = json_error_response(400, "Bad Request",
+                    R"({"ok":false,"error":"Missing 'program'"})");
+                return r;
+            }
+
+            auto accepted = std::chrono::steady_clock::now();
+            r.job = [program, accepted]() {
+                return http_response(200, "OK", "application/json; charset=utf-8",
+                                     handle_run_nan(program, accepted));
+            };
+        }
+        catch (const std::exception& e) {
+            r.response = json_error_response(400, "Bad Request",
+                std::string("{\"ok\":false,\"error\":\"Invalid JSON: ") + json_escape(e.what()) + "\"}");
+        }
+    }
+    else if (req.method == "POST" && path == "/save") {
+        std::string name = params.count("name") ? params["name"] : "star_code.cpp";
+        auto safe = sanitize_source_filename(name);
+        if (!safe) {
+            r.response = json_error_response(400, "Bad Request",
+                R"({"ok":false,"error":"Invalid filename. Use something like star_code.cpp or util.h"})");
+        } else {
+            std::string full = "user_codes/" + *safe;
+            std::ofstream out(full, std::ios::binary);
+            if (!out) {
+                r.response = json_error_response(500, "Internal Server Error",
+                    R"({"ok":false,"error":"Failed to open file for writing."})");
+            } else {
+                out << req.body;
+                out.close();
+                std::string body = std::string("{\"ok\":true,\"savedAs\":\"") + json_escape(*safe) +
+                                   "\",\"bytes\":" + std::to_string(req.body.size()) + "}";
+                r.response = http_response(200, "OK", "application/json; charset=utf-8", body);
+            }
+        }
+    }
+    else {
+        r.response = http_response(404, "Not Found", "text/plain; charset=utf-8",
+                                   "Not Found\n");
+    }
+
+    return r;
+}
+
+// ------------------------- Job runner -------------------------
+
+// Finished job responses travel back to the event loop through this queue;
+// the eventfd wakes epoll_wait so the loop can pick them up.
+struct JobResult {
+    uint64_t conn_id;
+    std::string response;
+};
+
+class CompletionQueue {
+public:
+    CompletionQueue() : event_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+    ~CompletionQueue() { if (event_fd_ >= 0) close(event_fd_); }
+
+    int fd() const { return event_fd_; }
+
+    void post(JobResult r) {
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            done_.push_back(std::move(r));
+        }
+        uint64_t one = 1;
+        ssize_t n = write(event_fd_, &one, sizeof(one));
+        (void)n; // counter overflow is impossible in practice; EAGAIN still leaves it readable
+    }
+
+    std::vector<JobResult> take() {
+        uint64_t counter;
+        while (read(event_fd_, &counter, sizeof(counter)) > 0) {}
+        std::lock_guard<std::mutex> lock(m_);
+        std::vector<JobResult> out;
+        out.swap(done_);
+        return out;
+    }
+
+private:
+    int event_fd_;
+    std::mutex m_;
+    std::vector<JobResult> done_;
+};
+
+// Fixed pool of compile/run workers. Each worker owns a deque: it takes its
+// own work from the front (oldest first, so queueing delay stays FIFO-like)
+// and, when idle, steals from the back of a busy neighbour. Admission is
+// bounded: once every worker is busy and queue_limit jobs are waiting,
+// try_submit refuses and the caller answers 503 instead of letting the
+// listen backlog overflow.
+class Scheduler {
+public:
+    Scheduler(size_t workers, size_t queue_limit, CompletionQueue& completions)
+        : completions_(completions), capacity_(workers + queue_limit) {
+        for (size_t i = 0; i < workers; i++)
+            workers_.push_back(std::make_unique<Worker>());
+        for (size_t i = 0; i < workers; i++)
+            threads_.emplace_back([this, i] { worker_loop(i); });
+    }
+
+    ~Scheduler() {
+        {
+            std::lock_guard<std::mutex> lock(idle_m_);
+            stop_ = true;
+        }
+        idle_cv_.notify_all();
+        for (auto& t : threads_) t.join();
+    }
+
+    bool try_submit(uint64_t conn_id, std::function<std::string()> work) {
+        size_t cur = admitted_.load();
+        do {
+            if (cur >= capacity_) return false;
+        } while (!admitted_.compare_exchange_weak(cur, cur + 1));
+
+        Task task = [this, conn_id, work = std::move(work)]() {
+            auto start = std::chrono::steady_clock::now();
+            std::string response;
+            try {
+                response = work();
+            } catch (const std::exception& e) {
+                response = json_error_response(500, "Internal Server Error",
+                    std::string("{\"ok\":false,\"error\":\"") + json_escape(e.what()) + "\"}");
+            }
+            record_service_time(std::chrono::steady_clock::now() - start);
+            admitted_--;
+            completions_.post({conn_id, std::move(response)});
+        };
+
+        size_t target = next_worker_++ % workers_.size();
+        {
+            std::lock_guard<std::mutex> lock(workers_[target]->m);
+            workers_[target]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(idle_m_);
+            queued_++;
+        }
+        idle_cv_.notify_one();
+        return true;
+    }
+
+    // Fork-join for the job running on the current worker: fn(i) for every
+    // i < n, with helpers pushed onto this worker's deque so idle workers
+    // can steal them. The caller works through the indices too and never
+    // waits on a helper that hasn't started, so it can't deadlock even when
+    // every other worker is busy. Off the pool, runs inline.
+    static void parallel_for(size_t n, const std::function<void(size_t)>& fn) {
+        Scheduler* self = current_;
+        if (!self || n < 2) {
+            for (size_t i = 0; i < n; i++) fn(i);
+            return;
+        }
+
+        struct Shared {
+            std::atomic<size_t> next{0};
+            size_t done = 0;
+            std::mutex m;
+            std::condition_variable cv;
+        };
+        auto shared = std::make_shared<Shared>();
+        // A helper may run long after we returned; it only touches `fn`
+        // while it holds an unfinished index, i.e. while we still wait.
+        auto drain = [shared, n, &fn]() {
+            for (size_t i; (i = shared->next++) < n;) {
+                fn(i);
+                std::lock_guard<std::mutex> lock(shared->m);
+                if (++shared->done == n) shared->cv.notify_all();
+            }
+        };
+
+        size_t helpers = std::min(n, self->workers_.size()) - 1;
+        {
+            std::lock_guard<std::mutex> lock(self->workers_[current_worker_]->m);
+            for (size_t k = 0; k < helpers; k++)
+                self->workers_[current_worker_]->tasks.push_back(drain);
+        }
+        {
+            std::lock_guard<std::mutex> lock(self->idle_m_);
+            self->queued_ += helpers;
+        }
+        self->idle_cv_.notify_all();
+
+        drain();
+        std::unique_lock<std::mutex> lock(shared->m);
+        shared->cv.wait(lock, [&] { return shared->done == n; });
+    }
+
+    // Seconds a rejected client should wait: the backlog ahead of it divided
+    // across the workers, at the recent average job duration.
+    int retry_after_seconds() const {
+        double avg_ms = avg_service_ms_.load();
+        double secs = avg_ms * (double)admitted_.load() / (double)workers_.size() / 1000.0;
+        return std::max(1, (int)std::ceil(secs));
+    }
+
+private:
+    using Task = std::function<void()>;
+
+    struct Worker {
+        std::mutex m;
+        std::deque<Task> tasks;
+    };
+
+    bool pop_local(size_t self, Task& out) {
+        Worker& w = *workers_[self];
+        std::lock_guard<std::mutex> lock(w.m);
+        if (w.tasks.empty()) return false;
+        out = std::move(w.tasks.front());
+        w.tasks.pop_front();
+        return true;
+    }
+
+    bool steal(size_t self, Task& out) {
+        for (size_t k = 1; k < workers_.size(); k++) {
+            Worker& victim = *workers_[(self + k) % workers_.size()];
+            std::lock_guard<std::mutex> lock(victim.m);
+            if (victim.tasks.empty()) continue;
+            out = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            return true;
+        }
+        return false;
+    }
+
+    void worker_loop(size_t self) {
+        current_ = this;
+        current_worker_ = self;
+        for (;;) {
+            Task task;
+            if (pop_local(self, task) || steal(self, task)) {
+                queued_--;
+                task();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(idle_m_);
+            idle_cv_.wait(lock, [this] { return stop_ || queued_.load() > 0; });
+            if (stop_ && queued_.load() == 0) return;
+        }
+    }
+
+    void record_service_time(std::chrono::steady_clock::duration d) {
+        double ms = std::chrono::duration<double, std::milli>(d).count();
+        double prev = avg_service_ms_.load();
+        avg_service_ms_.store(prev == 0.0 ? ms : prev * 0.8 + ms * 0.2);
+    }
+
+    CompletionQueue& completions_;
+    const size_t capacity_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+
+    std::atomic<size_t> admitted_{0};   // waiting + running jobs
+    std::atomic<size_t> queued_{0};     // tasks sitting in some deque
+    std::atomic<size_t> next_worker_{0};
+    std::atomic<double> avg_service_ms_{0.0};
+
+    std::mutex idle_m_;
+    std::condition_variable idle_cv_;
+    bool stop_ = false;
+
+    static thread_local Scheduler* current_;
+    static thread_local size_t current_worker_;
+};
+
+thread_local Scheduler* Scheduler::current_ = nullptr;
+thread_local size_t Scheduler::current_worker_ = 0;
+
+static void parallel_for(size_t n, const std::function<void(size_t)>& fn) {
+    Scheduler::parallel_for(n, fn);
+}
+
+// ------------------------- Event loop -------------------------
+
+constexpr size_t MAX_REQ = 512 * 1024;     // 512 KB limit for safety
+constexpr size_t MAX_CONNECTIONS = 1024;
+constexpr int READ_TIMEOUT_MS = 10000;     // whole request must arrive within this
+constexpr int WRITE_TIMEOUT_MS = 10000;
+
+enum class ConnState { Reading, Waiting, Writing };
+
+struct Connection {
+    int fd = -1;
+    ConnState state = ConnState::Reading;
+    std::string in;
+    size_t need = 0;   // total request size, known once headers are parsed
+    std::string out;
+    size_t out_off = 0;
+    std::chrono::steady_clock::time_point deadline;
+};
+
+// Returns true once `c.in` holds the header block plus Content-Length bytes of
+// body. Malformed or oversized headers also count as complete so the router
+// (or the size check) can answer them.
+static bool request_complete(Connection& c) {
+    if (c.need == 0) {
+        auto header_end = c.in.find("\r\n\r\n");
+        if (header_end == std::string::npos) return false;
+
+        c.need = header_end + 4;
+        auto req = parse_http_request(c.in);
+        if (req) {
+            auto it = req->headers.find("content-length");
+            if (it != req->headers.end()) {
+                try {
+                    long long content_length = std::stoll(it->second);
+                    if (content_length > 0) c.need += (size_t)content_length;
+                } catch (...) {}
+            }
+        }
+    }
+    return c.in.size() >= c.need;
+}
+
+// Edge-triggered epoll reactor. Every socket is non-blocking and each
+// connection walks Reading -> Waiting (job in flight) -> Writing -> closed.
+// Nothing on this thread ever waits for a compiler or a user program.
+class EventLoop {
+public:
+    EventLoop(int listen_fd, CompletionQueue& completions, Scheduler& jobs)
+        : listen_fd_(listen_fd), completions_(completions), jobs_(jobs) {}
+
+    int run() {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd_ < 0) {
+            perror("epoll_create1");
+            return 1;
+        }
+
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u64 = LISTENER_ID;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev);
+
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u64 = COMPLETIONS_ID;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, completions_.fd(), &ev);
+
+        epoll_event events[128];
+        for (;;) {
+            int n = epoll_wait(epoll_fd_, events, 128, next_timeout_ms());
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                perror("epoll_wait");
+                return 1;
+            }
+
+            for (int i = 0; i < n; i++) {
+                uint64_t id = events[i].data.u64;
+                if (id == LISTENER_ID) accept_clients();
+                else if (id == COMPLETIONS_ID) deliver_completions();
+                else handle_io(id, events[i].events);
+            }
+
+            expire_deadlines();
+        }
+    }
+
+private:
+    static constexpr uint64_t LISTENER_ID = 0;
+    static constexpr uint64_t COMPLETIONS_ID = 1;
+
+    using Clock = std::chrono::steady_clock;
+    using Deadline = std::pair<Clock::time_point, uint64_t>;
+
+    void accept_clients() {
+        for (;;) {
+            int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR) continue;
+                return; // EAGAIN, or transient errors like EMFILE
+            }
+            if (conns_.size() >= MAX_CONNECTIONS) {
+                close(fd);
+                continue;
+            }
+
+            uint64_t id = next_id_++;
+            Connection& c = conns_[id];
+            c.fd = fd;
+            set_deadline(id, c, READ_TIMEOUT_MS);
+
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.u64 = id;
+            epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+
+            // Data may already be waiting; with edge triggering we would not
+            // hear about it again.
+            on_readable(id, c);
+        }
+    }
+
+    void handle_io(uint64_t id, uint32_t events) {
+        auto it = conns_.find(id);
+        if (it == conns_.end()) return;
+        Connection& c = it->second;
+
+        if (events & (EPOLLERR | EPOLLHUP)) {
+            close_connection(id);
+            return;
+        }
+        if (c.state == ConnState::Reading && (events & (EPOLLIN | EPOLLRDHUP))) {
+            on_readable(id, c);
+            return;
+        }
+        if (c.state == ConnState::Writing && (events & EPOLLOUT)) {
+            on_writable(id, c);
+        }
+    }
+
+    void on_readable(uint64_t id, Connection& c) {
+        char buf[4096];
+        bool eof = false;
+        for (;;) {
+            ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+            if (n > 0) {
+                c.in.append(buf, buf + n);
+                if (c.in.size() > MAX_REQ) {
+                    respond(id, c, http_response(413, "Payload Too Large", "text/plain; charset=utf-8",
+                                                 "Request too large\n"));
+                    return;
+                }
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+            // EOF or hard error: answer whatever arrived, if anything did.
+            if (c.in.empty()) {
+                close_connection(id);
+                return;
+            }
+            eof = true;
+            break;
+        }
+
+        if (!request_complete(c) && !eof) return;
+        dispatch(id, c);
+    }
+
+    void dispatch(uint64_t id, Connection& c) {
+        auto req = parse_http_request(c.in);
+        c.in.clear();
+        c.in.shrink_to_fit();
+
+        if (!req) {
+            respond(id, c, http_response(400, "Bad Request", "text/plain; charset=utf-8",
+                                         "Bad Request\n"));
+            return;
+        }
+
+        RouteResult r = route_request(*req);
+        if (!r.job) {
+            respond(id, c, std::move(r.response));
+            return;
+        }
+
+        if (!jobs_.try_submit(id, std::move(r.job))) {
+            respond(id, c, http_response(503, "Service Unavailable", "application/json; charset=utf-8",
+                R"({"ok":false,"error":"Server busy, try again shortly"})",
+                "Retry-After: " + std::to_string(jobs_.retry_after_seconds()) + "\r\n"));
+            return;
+        }
+        c.state = ConnState::Waiting;
+        set_deadline(id, c, JOB_TIMEOUT_MS);
+    }
+
+    void deliver_completions() {
+        for (auto& done : completions_.take()) {
+            auto it = conns_.find(done.conn_id);
+            if (it == conns_.end()) continue; // client timed out or went away
+            respond(done.conn_id, it->second, std::move(done.response));
+        }
+    }
+
+    void respond(uint64_t id, Connection& c, std::string response) {
+        c.state = ConnState::Writing;
+        c.out = std::move(response);
+        c.out_off = 0;
+        set_deadline(id, c, WRITE_TIMEOUT_MS);
+        on_writable(id, c);
+    }
+
+    void on_writable(uint64_t id, Connection& c) {
+        while (c.out_off < c.out.size()) {
+            ssize_t n = send(c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off, MSG_NOSIGNAL);
+            if (n > 0) {
+                c.out_off += (size_t)n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return; // wait for EPOLLOUT
+            break;
+        }
+        close_connection(id);
+    }
+
+    void close_connection(uint64_t id) {
+        auto it = conns_.find(id);
+        if (it == conns_.end()) return;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, it->second.fd, nullptr);
+        close(it->second.fd);
+        conns_.erase(it);
+    }
+
+    void set_deadline(uint64_t id, Connection& c, int timeout_ms) {
+        c.deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+        deadlines_.push({c.deadline, id});
+    }
+
+    // Stale heap entries (connection gone or deadline moved) are skipped lazily.
+    bool deadline_is_live(const Deadline& d) const {
+        auto it = conns_.find(d.second);
+        return it != conns_.end() && it->second.deadline == d.first;
+    }
+
+    int next_timeout_ms() {
+        while (!deadlines_.empty() && !deadline_is_live(deadlines_.top())) deadlines_.pop();
+        if (deadlines_.empty()) return -1;
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadlines_.top().first - Clock::now()).count();
+        return wait < 0 ? 0 : (int)wait + 1;
+    }
+
+    void expire_deadlines() {
+        auto now = Clock::now();
+        while (!deadlines_.empty() && deadlines_.top().first <= now) {
+            Deadline d = deadlines_.top();
+            deadlines_.pop();
+            if (!deadline_is_live(d)) continue;
+
+            Connection& c = conns_[d.second];
+            if (c.state == ConnState::Waiting) {
+                // The job keeps running; its result is dropped when it lands.
+                respond(d.second, c, json_error_response(504, "Gateway Timeout",
+                    R"({"ok":false,"error":"Timed out waiting for a worker"})"));
+            } else {
+                close_connection(d.second);
+            }
+        }
+    }
+
+    int listen_fd_;
+    int epoll_fd_ = -1;
+    CompletionQueue& completions_;
+    Scheduler& jobs_;
+    uint64_t next_id_ = 2;
+    std::unordered_map<uint64_t, Connection> conns_;
+    std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> deadlines_;
+};
+
+// ------------------------- Main server -------------------------
+
+int main() {
+    // Peers and children may vanish mid-write; report that as an error, not a signal.
+    signal(SIGPIPE, SIG_IGN);
+
+    g_config = load_config();
+
+    // Before the zygote, so it (and every process it spawns) starts out in
+    // the server's leaf cgroup.
+    bool cgroups = g_cgroups.init(g_config.cgroups, g_config.run_memory_max,
+                                  g_config.run_cpu_percent, g_config.run_pids_max);
+
+    // First, while the process is still small and single-threaded.
+    if (!g_zygote.start())
+        std::cerr << "Zygote failed to start; spawning directly from the server.\n";
+    g_supervisor.start();
+
+    int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    int opt = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(PORT);
+    // Bind to localhost only for safety
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        perror("bind");
+        close(server_fd);
+        return 1;
+    }
+
+    if (listen(server_fd, SOMAXCONN) < 0) {
+        perror("listen");
+        close(server_fd);
+        return 1;
+    }
+
+    std::cout << "Server running on http://127.0.0.1:" << PORT << "\n";
+
+    std::cout << "Workers: " << g_config.workers << ", queue limit: " << g_config.queue_limit << "\n";
+    std::cout << "Run limits: " << (cgroups ? "cgroup v2 + rlimits" : "rlimits only") << "\n";
+
+    std::filesystem::create_directories("user_codes");
+    g_workspaces.init(2 * g_config.workers);
+    std::cout << "Workspaces: " << g_workspaces.root() << "\n";
+    g_sandboxes.init(g_config.sandbox_min, g_config.sandbox_max);
+
+    g_compiler_version = trim(run_process_capture({"g++", "--version"}, "", 5000, false).output);
+    g_compiler_version = g_compiler_version.substr(0, g_compiler_version.find('\n'));
+    g_compile_cache.init(g_config.cache_dir, g_config.cache_max_bytes);
+    g_object_cache.init(g_config.object_cache_dir, g_config.object_cache_max_bytes);
+    g_handles.init(g_config.handle_ttl, g_config.max_handles);
+    g_results.init(g_config.result_cache_bytes, g_config.result_ttl);
+    std::cout << "Compiler: " << g_compiler_version << "\n";
+
+    std::vector<std::vector<std::string>> profile_flags;
+    for (const auto& p : COMPILE_PROFILES) profile_flags.push_back(p.flags);
+    g_pch.init(g_config.pch_dir, g_config.pch_prologues, profile_flags);
+
+    CompletionQueue completions;
+    Scheduler jobs(g_config.workers, g_config.queue_limit, completions);
+    EventLoop loop(server_fd, completions, jobs);
+    int rc = loop.run();
+
     close(server_fd);
-    return 0;
+    return rc;
 }